@@ -33,6 +33,7 @@
         clang
         cmake
         gnumake
+        (python311.withPackages (ps: [ ps.sympy ]))
       ];
       buildPhase = ''
         cmake .. -DCMAKE_BUILD_TYPE=Release
@@ -0,0 +1,493 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "renderer.hh"
+#include "server.hh"
+
+// Benchmarks of the renderer's hot paths, from single calls of the surface
+// equations up to whole frames.
+//
+// Every benchmark is run a few times without measuring (to warm up caches and
+// let lazily initialized state settle), and then measured a number of times.
+// A single measurement times a batch of operations (e.g. a few thousand
+// surface evaluations, or one frame) and is reported as time per operation.
+// Results are printed to stdout as CSV or JSON, so that they can be compared
+// between builds.
+
+// Parameters of a benchmark run.
+struct bench_settings {
+    size_t warmup = 3;
+    size_t repetitions = 15;
+
+    // Only benchmarks whose name contains this string are run.
+    std::string filter;
+
+    bool json = false;
+};
+
+// Measurements of a single benchmark, in nanoseconds per operation.
+struct bench_result {
+    std::string name;
+    std::string parameters;
+    size_t operations;
+    std::vector<double> measurements;
+
+    // Returns the `p`-th percentile of the measurements (nearest-rank method,
+    // see https://en.wikipedia.org/wiki/Percentile#The_nearest-rank_method).
+    double percentile(double p) const {
+        std::vector<double> sorted = measurements;
+        std::sort(sorted.begin(), sorted.end());
+        auto rank = static_cast<size_t>(std::ceil(p / 100 * static_cast<double>(sorted.size())));
+        return sorted[std::max<size_t>(rank, 1) - 1];
+    }
+};
+
+// Runs benchmarks and collects their results.
+class bench_runner {
+public:
+    explicit bench_runner(const bench_settings& settings) : _settings(settings) {}
+
+    // Whether the benchmark with the given `name` should be run.
+    bool selected(const std::string& name) const {
+        return name.find(_settings.filter) != std::string::npos;
+    }
+
+    // Measures `task`, which performs `operations` operations every time it is
+    // called.
+    void measure(
+        const std::string& name,
+        const std::string& parameters,
+        size_t operations,
+        const std::function<void()>& task
+    ) {
+        if (!selected(name)) {
+            return;
+        }
+
+        for (size_t i = 0; i < _settings.warmup; ++i) {
+            task();
+        }
+
+        bench_result result{name, parameters, operations, {}};
+        for (size_t i = 0; i < _settings.repetitions; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            task();
+            std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+            result.measurements.push_back(elapsed.count() / static_cast<double>(operations));
+        }
+
+        // Progress goes to stderr, so that stdout stays machine-readable.
+        std::cerr << name << " " << parameters << ": " << result.percentile(50) << " ns/op" << std::endl;
+        _results.push_back(std::move(result));
+    }
+
+    void print(std::ostream& out) const {
+        out << std::fixed << std::setprecision(1);
+        if (_settings.json) {
+            print_json(out);
+        } else {
+            print_csv(out);
+        }
+    }
+
+private:
+    void print_csv(std::ostream& out) const {
+        out << "benchmark,parameters,operations,repetitions,median_ns,p95_ns,min_ns\n";
+        for (const auto& result : _results) {
+            out << result.name << ',' << result.parameters << ',' << result.operations << ','
+                << result.measurements.size() << ',' << result.percentile(50) << ','
+                << result.percentile(95) << ',' << result.percentile(0) << '\n';
+        }
+    }
+
+    void print_json(std::ostream& out) const {
+        out << "[\n";
+        for (size_t i = 0; i < _results.size(); ++i) {
+            const auto& result = _results[i];
+            out << "  {\"benchmark\": \"" << result.name << "\", "
+                << "\"parameters\": \"" << result.parameters << "\", "
+                << "\"operations\": " << result.operations << ", "
+                << "\"repetitions\": " << result.measurements.size() << ", "
+                << "\"median_ns\": " << result.percentile(50) << ", "
+                << "\"p95_ns\": " << result.percentile(95) << ", "
+                << "\"min_ns\": " << result.percentile(0) << "}"
+                << (i + 1 < _results.size() ? ",\n" : "\n");
+        }
+        out << "]\n";
+    }
+
+    bench_settings _settings;
+    std::vector<bench_result> _results;
+};
+
+// Keeps the compiler from optimizing away computations whose results are not
+// used otherwise.
+static volatile real sink;
+
+// The benchmarks. The struct is a friend of `renderer`, so that the rendering
+// stages can be called directly.
+struct renderer_benchmarks {
+    // Parameters of the surface on a `size` x `size` grid covering the whole
+    // [0, 1] x [0, 1] domain.
+    static std::vector<vec<2>> uv_grid(size_t size) {
+        std::vector<vec<2>> uv;
+        for (size_t y = 0; y < size; ++y) {
+            for (size_t x = 0; x < size; ++x) {
+                uv.push_back({
+                    static_cast<real>((x + 0.5) / static_cast<double>(size)),
+                    static_cast<real>((y + 0.5) / static_cast<double>(size))
+                });
+            }
+        }
+        return uv;
+    }
+
+    static render_settings settings(
+        size_t width,
+        size_t height,
+        size_t quality,
+        render_mode mode,
+        framebuffer_layout framebuffer = framebuffer_layout::split
+    ) {
+        render_settings result;
+        result.width = width;
+        result.height = height;
+        result.quality = quality;
+        result.mode = mode;
+        result.framebuffer = framebuffer;
+        result.frame_cache_budget = 0;
+        return result;
+    }
+
+    static std::string mode_name(render_mode mode) {
+        switch (mode) {
+        case render_mode::points:
+            return "points";
+        case render_mode::raster:
+            return "raster";
+        case render_mode::adaptive:
+            return "adaptive";
+        }
+        return "";
+    }
+
+    static std::string format_name(output_format format) {
+        switch (format) {
+        case output_format::p3:
+            return "p3";
+        case output_format::p6:
+            return "p6";
+        case output_format::y4m_420:
+            return "y4m_420";
+        case output_format::y4m_444:
+            return "y4m_444";
+        }
+        return "";
+    }
+
+    static std::string describe(const render_settings& settings) {
+        return "width=" + std::to_string(settings.width)
+            + " height=" + std::to_string(settings.height)
+            + " quality=" + std::to_string(settings.quality)
+            + " mode=" + mode_name(settings.mode)
+            + " framebuffer=" + (settings.framebuffer == framebuffer_layout::packed ? "packed" : "split")
+            + " tile_size=" + std::to_string(settings.tile_size)
+            + " culling=" + (settings.culling ? "on" : "off");
+    }
+
+    // Renders a frame into the renderer's framebuffers of the layout chosen in
+    // its settings.
+    static void render_single_frame(renderer& r, double t) {
+        if (r._settings.framebuffer == framebuffer_layout::packed) {
+            r.render_single_frame<false, packed_framebuffer>(t);
+        } else {
+            r.render_single_frame<false, split_framebuffer>(t);
+        }
+    }
+
+    // Single evaluations of the generated surface equations.
+    static void surface_equations(bench_runner& runner) {
+        auto uv = uv_grid(64);
+        std::vector<real> us, vs;
+        for (auto parameters : uv) {
+            us.push_back(static_cast<real>(2 * pi) * parameters[0]);
+            vs.push_back(static_cast<real>(pi) * parameters[1]);
+        }
+
+        auto parameters = "points=" + std::to_string(uv.size());
+        runner.measure("ffi_surface", parameters, uv.size(), [&] {
+            real out[3];
+            for (size_t i = 0; i < us.size(); ++i) {
+                ffi::surface(us[i], vs[i], out);
+                sink = out[0];
+            }
+        });
+        runner.measure("ffi_normal", parameters, uv.size(), [&] {
+            real out[3];
+            for (size_t i = 0; i < us.size(); ++i) {
+                ffi::normal(us[i], vs[i], out);
+                sink = out[0];
+            }
+        });
+
+        std::vector<real> x(uv.size()), y(uv.size()), z(uv.size());
+        runner.measure("ffi_surface_batch", parameters, uv.size(), [&] {
+            ffi::surface_batch(uv.size(), us.data(), vs.data(), x.data(), y.data(), z.data());
+            sink = x[0];
+        });
+        runner.measure("ffi_normal_batch", parameters, uv.size(), [&] {
+            ffi::normal_batch(uv.size(), us.data(), vs.data(), x.data(), y.data(), z.data());
+            sink = x[0];
+        });
+    }
+
+    // Sampling points of the surface in world coordinates.
+    static void surface_sampling(bench_runner& runner) {
+        auto uv = uv_grid(64);
+        surface s;
+        auto parameters = "points=" + std::to_string(uv.size());
+        runner.measure("surface_sample", parameters, uv.size(), [&] {
+            for (auto parameters : uv) {
+                sink = s.sample(parameters).position[0];
+            }
+        });
+
+        surface::point_array points;
+        points.resize(uv.size());
+        runner.measure("surface_sample_model_batch", parameters, uv.size(), [&] {
+            s.sample_model(uv, points);
+            sink = points.coordinates[0][0];
+        });
+
+        surface::point_array world;
+        runner.measure("surface_sample_batch", parameters, uv.size(), [&] {
+            s.sample_batch(uv, world);
+            sink = world.coordinates[0][0];
+        });
+        runner.measure("surface_to_world_batch", parameters, uv.size(), [&] {
+            s.to_world(points, 0, points.size(), world);
+            sink = world.coordinates[0][0];
+        });
+
+        // The same 64 x 64 grid, sampled row by row from its columns.
+        std::vector<real> u(64);
+        for (size_t x = 0; x < u.size(); ++x) {
+            u[x] = uv[x][0];
+        }
+        auto columns = s.sample_columns(u);
+        runner.measure("surface_sample_model_row", parameters, uv.size(), [&] {
+            for (size_t y = 0; y < 64; ++y) {
+                s.sample_model_row(columns, uv[y * 64][1], points, y * 64);
+            }
+            sink = points.coordinates[0][0];
+        });
+        runner.measure("surface_sample_row", parameters, uv.size(), [&] {
+            for (size_t y = 0; y < 64; ++y) {
+                s.sample_row(columns, uv[y * 64][1], world);
+            }
+            sink = world.coordinates[0][0];
+        });
+    }
+
+    // Drawing already sampled points.
+    static void samples(bench_runner& runner) {
+        renderer r(settings(256, 256, 3, render_mode::points));
+        surface frame_surface = r.surface_at(0);
+
+        std::vector<surface::point> points;
+        for (auto parameters : uv_grid(256)) {
+            points.push_back(frame_surface.sample(parameters));
+        }
+
+        auto measure = [&](auto& frame, const std::string& layout) {
+            render_stats stats;
+            auto parameters = "width=256 height=256 framebuffer=" + layout;
+            runner.measure("render_single_sample", parameters, points.size(), [&] {
+                frame.clear();
+                for (const auto& p : points) {
+                    r.render_single_sample<false>(p, frame, stats);
+                }
+            });
+        };
+        split_framebuffer split(256, 256);
+        measure(split, "split");
+        packed_framebuffer packed(256, 256);
+        measure(packed, "packed");
+    }
+
+    // Rendering whole frames (without encoding them).
+    static void frames(bench_runner& runner) {
+        std::vector<render_settings> jobs;
+        for (size_t size : {128, 256, 512}) {
+            for (size_t quality : {1, 2, 3}) {
+                jobs.push_back(settings(size, size, quality, render_mode::points));
+            }
+            jobs.push_back(settings(size, size, 3, render_mode::raster));
+            jobs.push_back(settings(size, size, 3, render_mode::adaptive));
+            jobs.push_back(settings(size, size, 3, render_mode::points, framebuffer_layout::packed));
+            jobs.push_back(settings(size, size, 3, render_mode::raster, framebuffer_layout::packed));
+            for (auto framebuffer : {framebuffer_layout::split, framebuffer_layout::packed}) {
+                jobs.push_back(settings(size, size, 3, render_mode::points, framebuffer));
+                jobs.back().tile_size = 32;
+                jobs.push_back(settings(size, size, 3, render_mode::points, framebuffer));
+                jobs.back().culling = false;
+            }
+        }
+
+        if (!runner.selected("render_single_frame")) {
+            return;
+        }
+        for (const auto& job : jobs) {
+            renderer r(job);
+            size_t frame = 0;
+            runner.measure("render_single_frame", describe(job), 1, [&] {
+                render_single_frame(r, r.frame_time(frame++));
+            });
+        }
+    }
+
+    // Encoding rendered frames.
+    static void encoding(bench_runner& runner) {
+        if (!runner.selected("frame_encode")) {
+            return;
+        }
+        for (size_t size : {256, 512, 1024}) {
+            for (auto layout : {framebuffer_layout::split, framebuffer_layout::packed}) {
+                renderer r(settings(size, size, 1, render_mode::raster, layout));
+                render_single_frame(r, 0);
+
+                for (auto format : {output_format::p6, output_format::p3, output_format::y4m_420, output_format::y4m_444}) {
+                    frame_writer writer(format);
+                    auto parameters = "width=" + std::to_string(size) + " height=" + std::to_string(size)
+                        + " format=" + format_name(format)
+                        + " framebuffer=" + (layout == framebuffer_layout::packed ? "packed" : "split");
+                    runner.measure("frame_encode", parameters, 1, [&] {
+                        if (layout == framebuffer_layout::packed) {
+                            sink = writer.encode(r._packed_buffers[0])[0];
+                        } else {
+                            sink = writer.encode(r._split_buffers[0])[0];
+                        }
+                    });
+                }
+            }
+        }
+    }
+
+    // Short jobs of different sizes, rendered by a new renderer each (as when
+    // every job runs in a separate process, minus starting the process), and
+    // by a server that reuses its renderers. Frame caches are disabled, so
+    // that repeated jobs are rendered again.
+    static void server_jobs(bench_runner& runner) {
+        if (!runner.selected("render_job")) {
+            return;
+        }
+        std::string lines;
+        size_t jobs = 0;
+        for (size_t size : {64, 128, 192}) {
+            for (size_t fps : {2, 4}) {
+                lines += "{\"id\": " + std::to_string(jobs++) + ", \"width\": " + std::to_string(size)
+                    + ", \"height\": " + std::to_string(size) + ", \"fps\": " + std::to_string(fps)
+                    + ", \"length\": 1}\n";
+            }
+        }
+
+        render_settings defaults;
+        defaults.frame_cache_budget = 0;
+        int null_output = ::open("/dev/null", O_WRONLY);
+
+        runner.measure("render_job", "renderers=new", jobs, [&] {
+            std::istringstream input(lines);
+            for (std::string line; std::getline(input, line);) {
+                renderer r(parse_job(parse_json_object(line), defaults).settings);
+                r.render(output_stream(null_output));
+            }
+        });
+
+        render_server server(defaults, jobs);
+        runner.measure("render_job", "renderers=reused", jobs, [&] {
+            int input[2];
+            if (::pipe(input) < 0) {
+                throw std::system_error(errno, std::generic_category(), "pipe");
+            }
+            // The jobs fit in the pipe's buffer, so they can be written
+            // before the server starts reading them.
+            write_all(input[1], std::span(reinterpret_cast<const unsigned char*>(lines.data()), lines.size()));
+            ::close(input[1]);
+            server.serve(input[0], null_output);
+            ::close(input[0]);
+        });
+
+        ::close(null_output);
+    }
+
+    static void run_all(bench_runner& runner) {
+        surface_equations(runner);
+        surface_sampling(runner);
+        samples(runner);
+        frames(runner);
+        encoding(runner);
+        server_jobs(runner);
+    }
+};
+
+int main(int argc, char** argv) {
+    bench_settings settings;
+
+    const char* usage = " [--help] [--format <csv|json>] [--warmup <runs>] [--repetitions <runs>] [--filter <name>]";
+    const char* help_message = "Benchmark the stages of rendering and print the results to the standard\n"
+                               "output. Times are given in nanoseconds per operation.\n"
+                               "\n"
+                               "Arguments:\n"
+                               "  --format <csv|json>  Format of the results. Default: csv.\n"
+                               "  --warmup <runs>      Number of unmeasured runs of every benchmark. Default: 3.\n"
+                               "  --repetitions <runs> Number of measured runs of every benchmark. Default: 15.\n"
+                               "  --filter <name>      Run only benchmarks whose name contains the given string.\n";
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--help") {
+            std::cout << argv[0] << usage << std::endl;
+            std::cout << help_message << std::endl;
+            return 0;
+        } else if (std::string(argv[i]) == "--warmup") {
+            settings.warmup = std::stoi(argv[++i]);
+        } else if (std::string(argv[i]) == "--repetitions") {
+            settings.repetitions = std::stoi(argv[++i]);
+            if (settings.repetitions == 0) {
+                std::cerr << "Number of repetitions must be positive" << std::endl;
+                return 1;
+            }
+        } else if (std::string(argv[i]) == "--filter") {
+            settings.filter = argv[++i];
+        } else if (std::string(argv[i]) == "--format") {
+            std::string value = argv[++i];
+            if (value == "csv") {
+                settings.json = false;
+            } else if (value == "json") {
+                settings.json = true;
+            } else {
+                std::cerr << "Unknown format: " << value << std::endl;
+                std::cerr << "Usage " << argv[0] << usage << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Unknown argument: " << argv[i] << std::endl;
+            std::cerr << "Usage " << argv[0] << usage << std::endl;
+            return 1;
+        }
+    }
+
+    bench_runner runner(settings);
+    renderer_benchmarks::run_all(runner);
+    runner.print(std::cout);
+
+    return 0;
+}
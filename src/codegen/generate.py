@@ -1,8 +1,20 @@
+# Generates C code evaluating the heart surface and its normal vectors.
+#
+# Writes `surface.{c,h}` (functions evaluating a single point),
+# `surface_batch.{c,h}` (functions evaluating arrays of points) and
+# `surface_grid.{c,h}` (functions evaluating the regular sample grid from
+# factors depending only on `u` or only on `v`: `grid_u_factors`,
+# `grid_v_factors` and `grid_row`) to the current working directory. The
+# renderer build runs this script as a custom command (see CMakeLists.txt);
+# the copies checked in next to it are used when SymPy is not available, and
+# can be refreshed by running the script in this directory.
 import os
 import sympy
 
 from sympy import plotting, sin, cos
-from sympy.utilities.codegen import codegen
+from sympy.codegen.ast import float32, real
+from sympy.codegen.rewriting import create_expand_pow_optimization
+from sympy.printing.c import C99CodePrinter
 
 u, v = sympy.symbols('u v', real=True)
 
@@ -27,14 +39,492 @@ n = n / n.norm()
 
 n = sympy.simplify(n)
 
-# Generate C code for the **** surface using the codegen() function:
-codegen(
-    (("surface", r), ("normal", n)),
-    language="C99",
-    project="renderer",
-    to_files=True,
+functions = (("surface", r), ("normal", n))
+
+
+# Expressions above contain sin/cos of many multiples of the same angle (up to
+# `cos(7*u)`). Computing each of them with a libm call is wasteful: sin/cos of
+# `k*u` follow from sin/cos of `(k-1)*u` and `u` by the angle addition formulas,
+# which cost two multiplications and an addition each.
+#
+# Returns the expressions with `sin(k*s)`/`cos(k*s)` replaced with symbols, and
+# a list of (symbol, definition) pairs computing them, in evaluation order.
+def share_multiple_angles(exprs):
+    multiples = {}
+    for expr in exprs:
+        for function in expr.atoms(sin, cos):
+            k, s = function.args[0].as_coeff_Mul()
+            if k.is_Integer and k > 0 and s in (u, v):
+                multiples[s] = max(multiples.get(s, 0), int(k))
+
+    definitions = []
+    replacements = {}
+    for s in (u, v):
+        if s not in multiples:
+            continue
+
+        sines = [None, sympy.Symbol(f"sin_{s}")]
+        cosines = [None, sympy.Symbol(f"cos_{s}")]
+        definitions += [(sines[1], sin(s)), (cosines[1], cos(s))]
+        for k in range(2, multiples[s] + 1):
+            sines.append(sympy.Symbol(f"sin_{k}{s}"))
+            cosines.append(sympy.Symbol(f"cos_{k}{s}"))
+            definitions += [
+                (sines[k], sines[k - 1] * cosines[1] + cosines[k - 1] * sines[1]),
+                (cosines[k], cosines[k - 1] * cosines[1] - sines[k - 1] * sines[1]),
+            ]
+
+        for k in range(1, multiples[s] + 1):
+            replacements[sin(k * s)] = sines[k]
+            replacements[cos(k * s)] = cosines[k]
+
+    return [expr.xreplace(replacements) for expr in exprs], definitions
+
+
+# Evaluation of a single function as a list of (variable, value) assignments
+# followed by one expression per output coordinate.
+#
+# Besides sharing the multiple angles, common subexpressions are extracted
+# with `sympy.cse` (the normal vector repeats its norm in every coordinate,
+# and the norm itself repeats many products).
+expand_pow = create_expand_pow_optimization(4, base_req=lambda base: True)
+
+
+def evaluation(expr):
+    outputs, assignments = share_multiple_angles(list(expr))
+    temporaries, outputs = sympy.cse(outputs, symbols=sympy.numbered_symbols("x"))
+    assignments += temporaries
+
+    # The recurrence computes both sin and cos of every multiple, drop the
+    # ones that are not used.
+    used = set().union(*(output.free_symbols for output in outputs))
+    for name, value in reversed(assignments):
+        if name in used:
+            used |= value.free_symbols
+    assignments = [(name, value) for name, value in assignments if name in used]
+
+    return (
+        [(name, expand_pow(value)) for name, value in assignments],
+        [expand_pow(output) for output in outputs],
+    )
+
+
+evaluations = [(name, evaluation(expr)) for name, expr in functions]
+
+
+# Code is emitted in two precisions. `suffix` is appended to the names of the
+# generated functions (following the libm convention of `sinf` being the
+# `float` variant of `sin`).
+class Precision:
+    def __init__(self, c_type, suffix, type_aliases):
+        self.c_type = c_type
+        self.suffix = suffix
+        self.type_aliases = type_aliases
+
+
+precisions = (
+    Precision("double", "", {}),
+    Precision("float", "f", {real: float32}),
 )
 
+
+class Printer(C99CodePrinter):
+    # Expanding powers leaves inverse square roots as `pow(x, -1.0/2.0)`, which
+    # is a libm call. Print them with `sqrt`, which has a vector instruction.
+    def _print_Pow(self, expr):
+        if expr.exp == sympy.Rational(-1, 2):
+            one = self._print(sympy.Float(1))
+            return f"({one}/{self._print(sympy.sqrt(expr.base))})"
+        return super()._print_Pow(expr)
+
+
+def printer(precision, batch):
+    user_functions = {}
+    if batch:
+        # libm's sin/cos can't be vectorized, so batch functions use
+        # branch-free polynomial approximations (see BATCH_MATH below).
+        user_functions = {
+            "sin": f"batch_sin{precision.suffix}",
+            "cos": f"batch_cos{precision.suffix}",
+        }
+    return Printer({
+        "type_aliases": precision.type_aliases,
+        "user_functions": user_functions,
+    })
+
+
+def body(name, precision, batch, indent, output):
+    assignments, outputs = dict(evaluations)[name]
+    p = printer(precision, batch)
+    lines = []
+    for variable, value in assignments:
+        lines.append(f"{indent}const {precision.c_type} {variable} = {p.doprint(value)};")
+    for i, value in enumerate(outputs):
+        lines.append(f"{indent}{output(i)} = {p.doprint(value)};")
+    return lines
+
+
+BANNER = """\
+/******************************************************************************
+ *                   Code generated with src/codegen/generate.py              *
+ *                                                                            *
+ *                      This file is part of 'renderer'                       *
+ ******************************************************************************/
+"""
+
+
+def scalar_signature(name, precision):
+    t = precision.c_type
+    return f"void {name}{precision.suffix}({t} u, {t} v, {t} *out)"
+
+
+def scalar_function(name, precision):
+    lines = [scalar_signature(name, precision) + " {", ""]
+    lines += body(name, precision, False, "   ", lambda i: f"out[{i}]")
+    lines += ["", "}"]
+    return "\n".join(lines)
+
+
+# The functions above evaluate a single point at a time. Batch variants evaluate
+# whole arrays of points and write the coordinates to separate arrays (structure
+# of arrays), so that the compiler can vectorize the loop over points.
+#
+# Vectorizable sin/cos. Arguments are reduced to r in [-pi/4, pi/4] (x = r + q *
+# pi/2, pi/2 split in three parts to keep the reduction exact for the small
+# arguments used here), then sin(r) and cos(r) are approximated with the
+# polynomials from fdlibm's __kernel_sin/__kernel_cos (Cephes' sinf/cosf for
+# floats) and the result is picked depending on the quadrant q mod 4. There are
+# no branches, table lookups or libm calls, so the compiler can evaluate several
+# points at once.
+#
+# Rounding to integer is done by adding and subtracting 1.5 * 2^52 (1.5 * 2^23
+# for floats, it leaves no fractional bits), because `nearbyint` is a libm call
+# on targets without SSE4.1.
+BATCH_MATH = """\
+#define BATCH_ROUND_MAGIC 6755399441055744.0
+#define BATCH_ROUND_MAGICF 12582912.0F
+
+static inline double batch_round(double x) {
+   return (x + BATCH_ROUND_MAGIC) - BATCH_ROUND_MAGIC;
+}
+
+static inline float batch_roundf(float x) {
+   return (x + BATCH_ROUND_MAGICF) - BATCH_ROUND_MAGICF;
+}
+
+static inline double batch_kernel_sin(double x) {
+   const double z = x*x;
+   const double r = 8.33333333332248946124e-03 + z*(-1.98412698298579493134e-04
+      + z*(2.75573137070700676789e-06 + z*(-2.50507602534068634195e-08
+      + z*1.58969099521155010221e-10)));
+   return x + z*x*(-1.66666666666666324348e-01 + z*r);
+}
+
+static inline float batch_kernel_sinf(float x) {
+   const float z = x*x;
+   return x + z*x*(-1.6666654611e-1F + z*(8.3321608736e-3F + z*-1.9515295891e-4F));
+}
+
+static inline double batch_kernel_cos(double x) {
+   const double z = x*x;
+   const double r = z*(4.16666666666666019037e-02 + z*(-1.38888888888741095749e-03
+      + z*(2.48015872894767294178e-05 + z*(-2.75573143513906633035e-07
+      + z*(2.08757232129817482790e-09 + z*-1.13596475577881948265e-11)))));
+   const double hz = 0.5*z;
+   const double w = 1.0 - hz;
+   return w + (((1.0 - w) - hz) + z*r);
+}
+
+static inline float batch_kernel_cosf(float x) {
+   const float z = x*x;
+   return 1.0F - 0.5F*z
+      + z*z*(4.166664568298827e-2F + z*(-1.388731625493765e-3F + z*2.443315711809948e-5F));
+}
+
+/* Splits x into r + q * pi/2 and returns r. Quadrant q mod 4 (0..3) is stored
+ * in `quadrant`. */
+static inline double batch_reduce(double x, double *quadrant) {
+   const double q = batch_round(x*6.36619772367581382433e-01);
+   *quadrant = q - 4*batch_round(0.25*q - 0.375);
+   return ((x - q*1.57079632673412561417e+00) - q*6.07710050630396597660e-11)
+      - q*2.02226624871116645580e-21;
+}
+
+static inline float batch_reducef(float x, float *quadrant) {
+   const float q = batch_roundf(x*0.636619772367581382433F);
+   *quadrant = q - 4*batch_roundf(0.25F*q - 0.375F);
+   return ((x - q*1.5703125F) - q*4.837512969970703125e-4F) - q*7.54978995489188216e-8F;
+}
+
+/* Returns sin(r + quadrant * pi/2) given s = sin(r), c = cos(r) and quadrant in
+ * 0..3. The right value is selected with exact multiplications by 0 and 1
+ * rather than conditionals, which the vectorizer can't always handle. */
+static inline double batch_select(double s, double c, double quadrant) {
+   const double upper = batch_round(0.5*quadrant - 0.25);
+   const double odd = quadrant - 2*upper;
+   return (1 - 2*upper)*(odd*c + (1 - odd)*s);
+}
+
+static inline float batch_selectf(float s, float c, float quadrant) {
+   const float upper = batch_roundf(0.5F*quadrant - 0.25F);
+   const float odd = quadrant - 2*upper;
+   return (1 - 2*upper)*(odd*c + (1 - odd)*s);
+}
+
+static inline double batch_sin(double x) {
+   double quadrant;
+   const double r = batch_reduce(x, &quadrant);
+   return batch_select(batch_kernel_sin(r), batch_kernel_cos(r), quadrant);
+}
+
+static inline float batch_sinf(float x) {
+   float quadrant;
+   const float r = batch_reducef(x, &quadrant);
+   return batch_selectf(batch_kernel_sinf(r), batch_kernel_cosf(r), quadrant);
+}
+
+/* cos(x) = sin(x + pi/2), so the quadrant is shifted by one. */
+static inline double batch_cos(double x) {
+   double quadrant;
+   const double r = batch_reduce(x, &quadrant);
+   quadrant = quadrant + 1 - 4*batch_round(0.25*quadrant - 0.125);
+   return batch_select(batch_kernel_sin(r), batch_kernel_cos(r), quadrant);
+}
+
+static inline float batch_cosf(float x) {
+   float quadrant;
+   const float r = batch_reducef(x, &quadrant);
+   quadrant = quadrant + 1 - 4*batch_roundf(0.25F*quadrant - 0.125F);
+   return batch_selectf(batch_kernel_sinf(r), batch_kernel_cosf(r), quadrant);
+}
+"""
+
+# Batch functions are compiled for several instruction sets, and the best one
+# supported by the CPU is picked at runtime (falling back to the baseline
+# instruction set).
+BATCH_TARGETS = '__attribute__((target_clones("avx512f", "avx2", "default")))'
+
+
+# `restrict` tells the compiler that output arrays don't overlap with the inputs
+# (it only matters for the definition, and the header has to be valid C++).
+def batch_signature(name, precision, restrict="restrict "):
+    t = precision.c_type
+    return (
+        f"void {name}_batch{precision.suffix}(size_t n, const {t} *{restrict}us, "
+        f"const {t} *{restrict}vs, {t} *{restrict}out_x, "
+        f"{t} *{restrict}out_y, {t} *{restrict}out_z)"
+    )
+
+
+def batch_function(name, precision):
+    t = precision.c_type
+    outputs = ("out_x", "out_y", "out_z")
+    lines = [BATCH_TARGETS, batch_signature(name, precision) + " {", ""]
+    lines.append("   for (size_t i = 0; i < n; ++i) {")
+    lines.append(f"      const {t} u = us[i];")
+    lines.append(f"      const {t} v = vs[i];")
+    lines += body(name, precision, True, "      ", lambda i: f"{outputs[i]}[i]")
+    lines.append("   }")
+    lines.append("")
+    lines.append("}")
+    return "\n".join(lines)
+
+
+# On a regular grid of parameters, all samples of a column share `u` and all
+# samples of a row share `v`. The equations are separable: the position is
+# `sin(v)` times a function of `u` (or a function of `v` alone), and the terms
+# of the normal (and of its norm) factor into such products too. Grid functions
+# evaluate the parts of the equations that depend on `u` alone once per column,
+# and the ones that depend on `v` alone once per row, so that each sample costs
+# a few multiplications and a square root instead of trigonometric functions.
+#
+# Replaces the largest subexpressions of `expr` that depend on a single
+# parameter with symbols, and records their definitions in `factors` (a dict
+# for each parameter, mapping definitions to symbols). Constants are grouped
+# with `u`, whose factors are computed only once.
+def separate(expr, factors):
+    symbols = expr.free_symbols
+    if not symbols:
+        return expr
+    if len(symbols) == 1:
+        (s,) = symbols
+        known = factors[s]
+        if expr not in known:
+            known[expr] = sympy.Symbol(f"{s}_factor{len(known)}")
+        return known[expr]
+
+    if expr.is_Add or expr.is_Mul:
+        # Arguments of sums and products are reordered freely, so the ones
+        # depending on the same parameter can be taken out together.
+        u_args = [arg for arg in expr.args if arg.free_symbols <= {u}]
+        v_args = [arg for arg in expr.args if arg.free_symbols == {v}]
+        mixed = [separate(arg, factors) for arg in expr.args if arg.free_symbols == {u, v}]
+        parts = [separate(expr.func(*args), factors) for args in (u_args, v_args) if args]
+        return expr.func(*(parts + mixed))
+
+    return expr.func(*(separate(arg, factors) for arg in expr.args))
+
+
+grid_factors = {u: {}, v: {}}
+grid_outputs = [separate(output, grid_factors) for _, expr in functions for output in expr]
+
+
+# Evaluation of expressions that depend only on `s` (one of the parameters),
+# in the same form as `evaluation`.
+def factor_evaluation(s):
+    return evaluation(list(grid_factors[s].keys()))
+
+
+def row_evaluation():
+    temporaries, outputs = sympy.cse(grid_outputs, symbols=sympy.numbered_symbols("x"))
+    return (
+        [(name, expand_pow(value)) for name, value in temporaries],
+        [expand_pow(output) for output in outputs],
+    )
+
+
+grid_evaluations = {"u": factor_evaluation(u), "v": factor_evaluation(v), "row": row_evaluation()}
+
+
+def grid_body(part, precision, batch, indent, output):
+    assignments, outputs = grid_evaluations[part]
+    p = printer(precision, batch)
+    lines = []
+    for variable, value in assignments:
+        lines.append(f"{indent}const {precision.c_type} {variable} = {p.doprint(value)};")
+    for i, value in enumerate(outputs):
+        lines.append(f"{indent}{output(i)} = {p.doprint(value)};")
+    return lines
+
+
+def grid_u_signature(precision, restrict="restrict "):
+    t = precision.c_type
+    return (
+        f"void grid_u_factors{precision.suffix}(size_t n, const {t} *{restrict}us, "
+        f"{t} *{restrict}factors, size_t stride)"
+    )
+
+
+def grid_v_signature(precision):
+    t = precision.c_type
+    return f"void grid_v_factors{precision.suffix}({t} v, {t} *factors)"
+
+
+def grid_row_signature(precision, restrict="restrict "):
+    t = precision.c_type
+    outputs = ", ".join(
+        f"{t} *{restrict}out_{name}" for name in ("x", "y", "z", "normal_x", "normal_y", "normal_z")
+    )
+    return (
+        f"void grid_row{precision.suffix}(size_t n, const {t} *{restrict}u_factors, "
+        f"size_t stride, const {t} *{restrict}v_factors, {outputs})"
+    )
+
+
+# Factors of columns are computed once per grid, so they are evaluated with
+# libm's sin/cos (and not vectorized).
+def grid_u_function(precision):
+    t = precision.c_type
+    lines = [grid_u_signature(precision) + " {", ""]
+    lines.append("   for (size_t i = 0; i < n; ++i) {")
+    lines.append(f"      const {t} u = us[i];")
+    lines += grid_body("u", precision, False, "      ", lambda k: f"factors[{k}*stride + i]")
+    lines.append("   }")
+    lines.append("")
+    lines.append("}")
+    return "\n".join(lines)
+
+
+def grid_v_function(precision):
+    lines = [grid_v_signature(precision) + " {", ""]
+    lines += grid_body("v", precision, False, "   ", lambda k: f"factors[{k}]")
+    lines += ["", "}"]
+    return "\n".join(lines)
+
+
+def grid_row_function(precision):
+    t = precision.c_type
+    outputs = ("out_x", "out_y", "out_z", "out_normal_x", "out_normal_y", "out_normal_z")
+    lines = [BATCH_TARGETS, grid_row_signature(precision) + " {", ""]
+    for k in range(len(grid_factors[v])):
+        lines.append(f"   const {t} v_factor{k} = v_factors[{k}];")
+    lines.append("   for (size_t i = 0; i < n; ++i) {")
+    for k in range(len(grid_factors[u])):
+        lines.append(f"      const {t} u_factor{k} = u_factors[{k}*stride + i];")
+    lines += grid_body("row", precision, True, "      ", lambda k: f"{outputs[k]}[i]")
+    lines.append("   }")
+    lines.append("")
+    lines.append("}")
+    return "\n".join(lines)
+
+
+def write_header(path, guard, includes, signatures, definitions=()):
+    with open(path, "w") as header:
+        header.write(BANNER)
+        header.write(f"\n\n#ifndef {guard}\n#define {guard}\n\n")
+        for include in includes:
+            header.write(f"#include <{include}>\n\n")
+        for definition in definitions:
+            header.write(definition + "\n")
+        if definitions:
+            header.write("\n")
+        for signature in signatures:
+            header.write(signature + ";\n")
+        header.write("\n#endif\n\n")
+
+
+write_header(
+    "surface.h",
+    "RENDERER__SURFACE__H",
+    [],
+    [scalar_signature(name, p) for p in precisions for name, _ in functions],
+)
+
+with open("surface.c", "w") as source:
+    source.write(BANNER)
+    source.write('#include "surface.h"\n#include <math.h>\n')
+    for precision in precisions:
+        for name, _ in functions:
+            source.write("\n" + scalar_function(name, precision) + "\n")
+
+write_header(
+    "surface_batch.h",
+    "RENDERER__SURFACE_BATCH__H",
+    ["stddef.h"],
+    [batch_signature(name, p, restrict="") for p in precisions for name, _ in functions],
+)
+
+with open("surface_batch.c", "w") as source:
+    source.write(BANNER)
+    source.write('#include "surface_batch.h"\n#include <math.h>\n\n')
+    source.write(BATCH_MATH)
+    for precision in precisions:
+        for name, _ in functions:
+            source.write("\n" + batch_function(name, precision) + "\n")
+
+write_header(
+    "surface_grid.h",
+    "RENDERER__SURFACE_GRID__H",
+    ["stddef.h"],
+    [
+        signature
+        for p in precisions
+        for signature in (grid_u_signature(p, restrict=""), grid_v_signature(p), grid_row_signature(p, restrict=""))
+    ],
+    # Number of factors computed for every column and every row.
+    [
+        f"#define GRID_U_FACTORS {len(grid_factors[u])}",
+        f"#define GRID_V_FACTORS {len(grid_factors[v])}",
+    ],
+)
+
+with open("surface_grid.c", "w") as source:
+    source.write(BANNER)
+    source.write('#include "surface_grid.h"\n#include <math.h>\n')
+    for precision in precisions:
+        for function in (grid_u_function, grid_v_function, grid_row_function):
+            source.write("\n" + function(precision) + "\n")
+
 # Plot if env var PLOT is set:
 if "PLOT" in os.environ:
     plotting.plot3d_parametric_surface(
@@ -1,25 +1,97 @@
 /******************************************************************************
- *                       Code generated with SymPy 1.12                       *
- *                                                                            *
- *              See http://www.sympy.org/ for more information.               *
+ *                   Code generated with src/codegen/generate.py              *
  *                                                                            *
  *                      This file is part of 'renderer'                       *
  ******************************************************************************/
 #include "surface.h"
 #include <math.h>
 
-void surface(double u, double v, double *out_3397100410920502345) {
+void surface(double u, double v, double *out) {
+
+   const double sin_u = sin(u);
+   const double cos_u = cos(u);
+   const double sin_2u = 2*cos_u*sin_u;
+   const double cos_2u = cos_u*cos_u - (sin_u*sin_u);
+   const double sin_3u = cos_2u*sin_u + cos_u*sin_2u;
+   const double cos_3u = cos_2u*cos_u - sin_2u*sin_u;
+   const double cos_4u = cos_3u*cos_u - sin_3u*sin_u;
+   const double sin_v = sin(v);
+   const double cos_v = cos(v);
+   out[0] = sin_v*(-4*sin_3u + 15*sin_u);
+   out[1] = 8*cos_v;
+   out[2] = sin_v*(-5*cos_2u - 2*cos_3u - cos_4u + 15*cos_u);
+
+}
+
+void normal(double u, double v, double *out) {
+
+   const double sin_u = sin(u);
+   const double cos_u = cos(u);
+   const double sin_2u = 2*cos_u*sin_u;
+   const double cos_2u = cos_u*cos_u - (sin_u*sin_u);
+   const double sin_3u = cos_2u*sin_u + cos_u*sin_2u;
+   const double cos_3u = cos_2u*cos_u - sin_2u*sin_u;
+   const double sin_4u = cos_3u*sin_u + cos_u*sin_3u;
+   const double cos_4u = cos_3u*cos_u - sin_3u*sin_u;
+   const double sin_5u = cos_4u*sin_u + cos_u*sin_4u;
+   const double cos_5u = cos_4u*cos_u - sin_4u*sin_u;
+   const double sin_6u = cos_5u*sin_u + cos_u*sin_5u;
+   const double cos_6u = cos_5u*cos_u - sin_5u*sin_u;
+   const double cos_7u = cos_6u*cos_u - sin_6u*sin_u;
+   const double sin_v = sin(v);
+   const double cos_v = cos(v);
+   const double x0 = sin_v*sin_v;
+   const double x1 = sin_u*sin_u*sin_u*sin_u;
+   const double x2 = (1.0/sqrt(576*x0*((-4*cos_3u + 5*cos_u)*(-4*cos_3u + 5*cos_u)) + 64*x0*((10*sin_2u + 6*sin_3u + 4*sin_4u - 15*sin_u)*(10*sin_2u + 6*sin_3u + 4*sin_4u - 15*sin_u)) + (1.0/4.0)*(cos_v*cos_v)*((192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u))*(192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u)))))*1.0/fabs(sin_v);
+   const double x3 = x0*x2;
+   const double x4 = (1 - cos_2u)*(1 - cos_2u);
+   out[0] = x3*(80*sin_2u + 48*sin_3u + 32*sin_4u - 120*sin_u);
+   out[1] = cos_v*sin_v*x2*(180*cos_2u - 24*cos_3u*x4 - 63.0/2.0*cos_3u + 30*cos_4u - 42*cos_5u + 16*cos_6u*cos_u - 90*cos_u*x4 + (151.0/2.0)*cos_u - 249);
+   out[2] = x3*(96*cos_3u - 120*cos_u);
+
+}
+
+void surfacef(float u, float v, float *out) {
 
-   out_3397100410920502345[0] = (15*sin(u) - 4*sin(3*u))*sin(v);
-   out_3397100410920502345[1] = 8*cos(v);
-   out_3397100410920502345[2] = (15*cos(u) - 5*cos(2*u) - 2*cos(3*u) - cos(4*u))*sin(v);
+   const float sin_u = sinf(u);
+   const float cos_u = cosf(u);
+   const float sin_2u = 2*cos_u*sin_u;
+   const float cos_2u = cos_u*cos_u - (sin_u*sin_u);
+   const float sin_3u = cos_2u*sin_u + cos_u*sin_2u;
+   const float cos_3u = cos_2u*cos_u - sin_2u*sin_u;
+   const float cos_4u = cos_3u*cos_u - sin_3u*sin_u;
+   const float sin_v = sinf(v);
+   const float cos_v = cosf(v);
+   out[0] = sin_v*(-4*sin_3u + 15*sin_u);
+   out[1] = 8*cos_v;
+   out[2] = sin_v*(-5*cos_2u - 2*cos_3u - cos_4u + 15*cos_u);
 
 }
 
-void normal(double u, double v, double *out_5155765418550029069) {
+void normalf(float u, float v, float *out) {
 
-   out_5155765418550029069[0] = (-120*sin(u) + 80*sin(2*u) + 48*sin(3*u) + 32*sin(4*u))*pow(sin(v), 2)/(sqrt(576*pow(5*cos(u) - 4*cos(3*u), 2)*pow(sin(v), 2) + 64*pow(-15*sin(u) + 10*sin(2*u) + 6*sin(3*u) + 4*sin(4*u), 2)*pow(sin(v), 2) + (1.0/4.0)*pow(720*pow(sin(u), 4)*cos(u) + 192*pow(sin(u), 4)*cos(3*u) - 480*pow(sin(u), 4) + 1200*pow(sin(u), 2) - 151*cos(u) + 63*cos(3*u) + 68*cos(5*u) - 16*cos(7*u) + 78, 2)*pow(cos(v), 2))*fabs(sin(v)));
-   out_5155765418550029069[1] = (-90*pow(1 - cos(2*u), 2)*cos(u) - 24*pow(1 - cos(2*u), 2)*cos(3*u) + 16*cos(u)*cos(6*u) + (151.0/2.0)*cos(u) + 180*cos(2*u) - 63.0/2.0*cos(3*u) + 30*cos(4*u) - 42*cos(5*u) - 249)*sin(v)*cos(v)/(sqrt(576*pow(5*cos(u) - 4*cos(3*u), 2)*pow(sin(v), 2) + 64*pow(-15*sin(u) + 10*sin(2*u) + 6*sin(3*u) + 4*sin(4*u), 2)*pow(sin(v), 2) + (1.0/4.0)*pow(720*pow(sin(u), 4)*cos(u) + 192*pow(sin(u), 4)*cos(3*u) - 480*pow(sin(u), 4) + 1200*pow(sin(u), 2) - 151*cos(u) + 63*cos(3*u) + 68*cos(5*u) - 16*cos(7*u) + 78, 2)*pow(cos(v), 2))*fabs(sin(v)));
-   out_5155765418550029069[2] = (-120*cos(u) + 96*cos(3*u))*pow(sin(v), 2)/(sqrt(576*pow(5*cos(u) - 4*cos(3*u), 2)*pow(sin(v), 2) + 64*pow(-15*sin(u) + 10*sin(2*u) + 6*sin(3*u) + 4*sin(4*u), 2)*pow(sin(v), 2) + (1.0/4.0)*pow(720*pow(sin(u), 4)*cos(u) + 192*pow(sin(u), 4)*cos(3*u) - 480*pow(sin(u), 4) + 1200*pow(sin(u), 2) - 151*cos(u) + 63*cos(3*u) + 68*cos(5*u) - 16*cos(7*u) + 78, 2)*pow(cos(v), 2))*fabs(sin(v)));
+   const float sin_u = sinf(u);
+   const float cos_u = cosf(u);
+   const float sin_2u = 2*cos_u*sin_u;
+   const float cos_2u = cos_u*cos_u - (sin_u*sin_u);
+   const float sin_3u = cos_2u*sin_u + cos_u*sin_2u;
+   const float cos_3u = cos_2u*cos_u - sin_2u*sin_u;
+   const float sin_4u = cos_3u*sin_u + cos_u*sin_3u;
+   const float cos_4u = cos_3u*cos_u - sin_3u*sin_u;
+   const float sin_5u = cos_4u*sin_u + cos_u*sin_4u;
+   const float cos_5u = cos_4u*cos_u - sin_4u*sin_u;
+   const float sin_6u = cos_5u*sin_u + cos_u*sin_5u;
+   const float cos_6u = cos_5u*cos_u - sin_5u*sin_u;
+   const float cos_7u = cos_6u*cos_u - sin_6u*sin_u;
+   const float sin_v = sinf(v);
+   const float cos_v = cosf(v);
+   const float x0 = sin_v*sin_v;
+   const float x1 = sin_u*sin_u*sin_u*sin_u;
+   const float x2 = (1.0F/sqrtf(576*x0*((-4*cos_3u + 5*cos_u)*(-4*cos_3u + 5*cos_u)) + 64*x0*((10*sin_2u + 6*sin_3u + 4*sin_4u - 15*sin_u)*(10*sin_2u + 6*sin_3u + 4*sin_4u - 15*sin_u)) + (1.0F/4.0F)*(cos_v*cos_v)*((192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u))*(192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u)))))*1.0F/fabsf(sin_v);
+   const float x3 = x0*x2;
+   const float x4 = (1 - cos_2u)*(1 - cos_2u);
+   out[0] = x3*(80*sin_2u + 48*sin_3u + 32*sin_4u - 120*sin_u);
+   out[1] = cos_v*sin_v*x2*(180*cos_2u - 24*cos_3u*x4 - 63.0F/2.0F*cos_3u + 30*cos_4u - 42*cos_5u + 16*cos_6u*cos_u - 90*cos_u*x4 + (151.0F/2.0F)*cos_u - 249);
+   out[2] = x3*(96*cos_3u - 120*cos_u);
 
 }
@@ -1,7 +1,5 @@
 /******************************************************************************
- *                       Code generated with SymPy 1.12                       *
- *                                                                            *
- *              See http://www.sympy.org/ for more information.               *
+ *                   Code generated with src/codegen/generate.py              *
  *                                                                            *
  *                      This file is part of 'renderer'                       *
  ******************************************************************************/
@@ -10,8 +8,10 @@
 #ifndef RENDERER__SURFACE__H
 #define RENDERER__SURFACE__H
 
-void surface(double u, double v, double *out_3397100410920502345);
-void normal(double u, double v, double *out_5155765418550029069);
+void surface(double u, double v, double *out);
+void normal(double u, double v, double *out);
+void surfacef(float u, float v, float *out);
+void normalf(float u, float v, float *out);
 
 #endif
 
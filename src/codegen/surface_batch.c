@@ -0,0 +1,214 @@
+/******************************************************************************
+ *                   Code generated with src/codegen/generate.py              *
+ *                                                                            *
+ *                      This file is part of 'renderer'                       *
+ ******************************************************************************/
+#include "surface_batch.h"
+#include <math.h>
+
+#define BATCH_ROUND_MAGIC 6755399441055744.0
+#define BATCH_ROUND_MAGICF 12582912.0F
+
+static inline double batch_round(double x) {
+   return (x + BATCH_ROUND_MAGIC) - BATCH_ROUND_MAGIC;
+}
+
+static inline float batch_roundf(float x) {
+   return (x + BATCH_ROUND_MAGICF) - BATCH_ROUND_MAGICF;
+}
+
+static inline double batch_kernel_sin(double x) {
+   const double z = x*x;
+   const double r = 8.33333333332248946124e-03 + z*(-1.98412698298579493134e-04
+      + z*(2.75573137070700676789e-06 + z*(-2.50507602534068634195e-08
+      + z*1.58969099521155010221e-10)));
+   return x + z*x*(-1.66666666666666324348e-01 + z*r);
+}
+
+static inline float batch_kernel_sinf(float x) {
+   const float z = x*x;
+   return x + z*x*(-1.6666654611e-1F + z*(8.3321608736e-3F + z*-1.9515295891e-4F));
+}
+
+static inline double batch_kernel_cos(double x) {
+   const double z = x*x;
+   const double r = z*(4.16666666666666019037e-02 + z*(-1.38888888888741095749e-03
+      + z*(2.48015872894767294178e-05 + z*(-2.75573143513906633035e-07
+      + z*(2.08757232129817482790e-09 + z*-1.13596475577881948265e-11)))));
+   const double hz = 0.5*z;
+   const double w = 1.0 - hz;
+   return w + (((1.0 - w) - hz) + z*r);
+}
+
+static inline float batch_kernel_cosf(float x) {
+   const float z = x*x;
+   return 1.0F - 0.5F*z
+      + z*z*(4.166664568298827e-2F + z*(-1.388731625493765e-3F + z*2.443315711809948e-5F));
+}
+
+/* Splits x into r + q * pi/2 and returns r. Quadrant q mod 4 (0..3) is stored
+ * in `quadrant`. */
+static inline double batch_reduce(double x, double *quadrant) {
+   const double q = batch_round(x*6.36619772367581382433e-01);
+   *quadrant = q - 4*batch_round(0.25*q - 0.375);
+   return ((x - q*1.57079632673412561417e+00) - q*6.07710050630396597660e-11)
+      - q*2.02226624871116645580e-21;
+}
+
+static inline float batch_reducef(float x, float *quadrant) {
+   const float q = batch_roundf(x*0.636619772367581382433F);
+   *quadrant = q - 4*batch_roundf(0.25F*q - 0.375F);
+   return ((x - q*1.5703125F) - q*4.837512969970703125e-4F) - q*7.54978995489188216e-8F;
+}
+
+/* Returns sin(r + quadrant * pi/2) given s = sin(r), c = cos(r) and quadrant in
+ * 0..3. The right value is selected with exact multiplications by 0 and 1
+ * rather than conditionals, which the vectorizer can't always handle. */
+static inline double batch_select(double s, double c, double quadrant) {
+   const double upper = batch_round(0.5*quadrant - 0.25);
+   const double odd = quadrant - 2*upper;
+   return (1 - 2*upper)*(odd*c + (1 - odd)*s);
+}
+
+static inline float batch_selectf(float s, float c, float quadrant) {
+   const float upper = batch_roundf(0.5F*quadrant - 0.25F);
+   const float odd = quadrant - 2*upper;
+   return (1 - 2*upper)*(odd*c + (1 - odd)*s);
+}
+
+static inline double batch_sin(double x) {
+   double quadrant;
+   const double r = batch_reduce(x, &quadrant);
+   return batch_select(batch_kernel_sin(r), batch_kernel_cos(r), quadrant);
+}
+
+static inline float batch_sinf(float x) {
+   float quadrant;
+   const float r = batch_reducef(x, &quadrant);
+   return batch_selectf(batch_kernel_sinf(r), batch_kernel_cosf(r), quadrant);
+}
+
+/* cos(x) = sin(x + pi/2), so the quadrant is shifted by one. */
+static inline double batch_cos(double x) {
+   double quadrant;
+   const double r = batch_reduce(x, &quadrant);
+   quadrant = quadrant + 1 - 4*batch_round(0.25*quadrant - 0.125);
+   return batch_select(batch_kernel_sin(r), batch_kernel_cos(r), quadrant);
+}
+
+static inline float batch_cosf(float x) {
+   float quadrant;
+   const float r = batch_reducef(x, &quadrant);
+   quadrant = quadrant + 1 - 4*batch_roundf(0.25F*quadrant - 0.125F);
+   return batch_selectf(batch_kernel_sinf(r), batch_kernel_cosf(r), quadrant);
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void surface_batch(size_t n, const double *restrict us, const double *restrict vs, double *restrict out_x, double *restrict out_y, double *restrict out_z) {
+
+   for (size_t i = 0; i < n; ++i) {
+      const double u = us[i];
+      const double v = vs[i];
+      const double sin_u = batch_sin(u);
+      const double cos_u = batch_cos(u);
+      const double sin_2u = 2*cos_u*sin_u;
+      const double cos_2u = cos_u*cos_u - (sin_u*sin_u);
+      const double sin_3u = cos_2u*sin_u + cos_u*sin_2u;
+      const double cos_3u = cos_2u*cos_u - sin_2u*sin_u;
+      const double cos_4u = cos_3u*cos_u - sin_3u*sin_u;
+      const double sin_v = batch_sin(v);
+      const double cos_v = batch_cos(v);
+      out_x[i] = sin_v*(-4*sin_3u + 15*sin_u);
+      out_y[i] = 8*cos_v;
+      out_z[i] = sin_v*(-5*cos_2u - 2*cos_3u - cos_4u + 15*cos_u);
+   }
+
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void normal_batch(size_t n, const double *restrict us, const double *restrict vs, double *restrict out_x, double *restrict out_y, double *restrict out_z) {
+
+   for (size_t i = 0; i < n; ++i) {
+      const double u = us[i];
+      const double v = vs[i];
+      const double sin_u = batch_sin(u);
+      const double cos_u = batch_cos(u);
+      const double sin_2u = 2*cos_u*sin_u;
+      const double cos_2u = cos_u*cos_u - (sin_u*sin_u);
+      const double sin_3u = cos_2u*sin_u + cos_u*sin_2u;
+      const double cos_3u = cos_2u*cos_u - sin_2u*sin_u;
+      const double sin_4u = cos_3u*sin_u + cos_u*sin_3u;
+      const double cos_4u = cos_3u*cos_u - sin_3u*sin_u;
+      const double sin_5u = cos_4u*sin_u + cos_u*sin_4u;
+      const double cos_5u = cos_4u*cos_u - sin_4u*sin_u;
+      const double sin_6u = cos_5u*sin_u + cos_u*sin_5u;
+      const double cos_6u = cos_5u*cos_u - sin_5u*sin_u;
+      const double cos_7u = cos_6u*cos_u - sin_6u*sin_u;
+      const double sin_v = batch_sin(v);
+      const double cos_v = batch_cos(v);
+      const double x0 = sin_v*sin_v;
+      const double x1 = sin_u*sin_u*sin_u*sin_u;
+      const double x2 = (1.0/sqrt(576*x0*((-4*cos_3u + 5*cos_u)*(-4*cos_3u + 5*cos_u)) + 64*x0*((10*sin_2u + 6*sin_3u + 4*sin_4u - 15*sin_u)*(10*sin_2u + 6*sin_3u + 4*sin_4u - 15*sin_u)) + (1.0/4.0)*(cos_v*cos_v)*((192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u))*(192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u)))))*1.0/fabs(sin_v);
+      const double x3 = x0*x2;
+      const double x4 = (1 - cos_2u)*(1 - cos_2u);
+      out_x[i] = x3*(80*sin_2u + 48*sin_3u + 32*sin_4u - 120*sin_u);
+      out_y[i] = cos_v*sin_v*x2*(180*cos_2u - 24*cos_3u*x4 - 63.0/2.0*cos_3u + 30*cos_4u - 42*cos_5u + 16*cos_6u*cos_u - 90*cos_u*x4 + (151.0/2.0)*cos_u - 249);
+      out_z[i] = x3*(96*cos_3u - 120*cos_u);
+   }
+
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void surface_batchf(size_t n, const float *restrict us, const float *restrict vs, float *restrict out_x, float *restrict out_y, float *restrict out_z) {
+
+   for (size_t i = 0; i < n; ++i) {
+      const float u = us[i];
+      const float v = vs[i];
+      const float sin_u = batch_sinf(u);
+      const float cos_u = batch_cosf(u);
+      const float sin_2u = 2*cos_u*sin_u;
+      const float cos_2u = cos_u*cos_u - (sin_u*sin_u);
+      const float sin_3u = cos_2u*sin_u + cos_u*sin_2u;
+      const float cos_3u = cos_2u*cos_u - sin_2u*sin_u;
+      const float cos_4u = cos_3u*cos_u - sin_3u*sin_u;
+      const float sin_v = batch_sinf(v);
+      const float cos_v = batch_cosf(v);
+      out_x[i] = sin_v*(-4*sin_3u + 15*sin_u);
+      out_y[i] = 8*cos_v;
+      out_z[i] = sin_v*(-5*cos_2u - 2*cos_3u - cos_4u + 15*cos_u);
+   }
+
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void normal_batchf(size_t n, const float *restrict us, const float *restrict vs, float *restrict out_x, float *restrict out_y, float *restrict out_z) {
+
+   for (size_t i = 0; i < n; ++i) {
+      const float u = us[i];
+      const float v = vs[i];
+      const float sin_u = batch_sinf(u);
+      const float cos_u = batch_cosf(u);
+      const float sin_2u = 2*cos_u*sin_u;
+      const float cos_2u = cos_u*cos_u - (sin_u*sin_u);
+      const float sin_3u = cos_2u*sin_u + cos_u*sin_2u;
+      const float cos_3u = cos_2u*cos_u - sin_2u*sin_u;
+      const float sin_4u = cos_3u*sin_u + cos_u*sin_3u;
+      const float cos_4u = cos_3u*cos_u - sin_3u*sin_u;
+      const float sin_5u = cos_4u*sin_u + cos_u*sin_4u;
+      const float cos_5u = cos_4u*cos_u - sin_4u*sin_u;
+      const float sin_6u = cos_5u*sin_u + cos_u*sin_5u;
+      const float cos_6u = cos_5u*cos_u - sin_5u*sin_u;
+      const float cos_7u = cos_6u*cos_u - sin_6u*sin_u;
+      const float sin_v = batch_sinf(v);
+      const float cos_v = batch_cosf(v);
+      const float x0 = sin_v*sin_v;
+      const float x1 = sin_u*sin_u*sin_u*sin_u;
+      const float x2 = (1.0F/sqrtf(576*x0*((-4*cos_3u + 5*cos_u)*(-4*cos_3u + 5*cos_u)) + 64*x0*((10*sin_2u + 6*sin_3u + 4*sin_4u - 15*sin_u)*(10*sin_2u + 6*sin_3u + 4*sin_4u - 15*sin_u)) + (1.0F/4.0F)*(cos_v*cos_v)*((192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u))*(192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u)))))*1.0F/fabsf(sin_v);
+      const float x3 = x0*x2;
+      const float x4 = (1 - cos_2u)*(1 - cos_2u);
+      out_x[i] = x3*(80*sin_2u + 48*sin_3u + 32*sin_4u - 120*sin_u);
+      out_y[i] = cos_v*sin_v*x2*(180*cos_2u - 24*cos_3u*x4 - 63.0F/2.0F*cos_3u + 30*cos_4u - 42*cos_5u + 16*cos_6u*cos_u - 90*cos_u*x4 + (151.0F/2.0F)*cos_u - 249);
+      out_z[i] = x3*(96*cos_3u - 120*cos_u);
+   }
+
+}
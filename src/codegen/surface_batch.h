@@ -0,0 +1,19 @@
+/******************************************************************************
+ *                   Code generated with src/codegen/generate.py              *
+ *                                                                            *
+ *                      This file is part of 'renderer'                       *
+ ******************************************************************************/
+
+
+#ifndef RENDERER__SURFACE_BATCH__H
+#define RENDERER__SURFACE_BATCH__H
+
+#include <stddef.h>
+
+void surface_batch(size_t n, const double *us, const double *vs, double *out_x, double *out_y, double *out_z);
+void normal_batch(size_t n, const double *us, const double *vs, double *out_x, double *out_y, double *out_z);
+void surface_batchf(size_t n, const float *us, const float *vs, float *out_x, float *out_y, float *out_z);
+void normal_batchf(size_t n, const float *us, const float *vs, float *out_x, float *out_y, float *out_z);
+
+#endif
+
@@ -0,0 +1,161 @@
+/******************************************************************************
+ *                   Code generated with src/codegen/generate.py              *
+ *                                                                            *
+ *                      This file is part of 'renderer'                       *
+ ******************************************************************************/
+#include "surface_grid.h"
+#include <math.h>
+
+void grid_u_factors(size_t n, const double *restrict us, double *restrict factors, size_t stride) {
+
+   for (size_t i = 0; i < n; ++i) {
+      const double u = us[i];
+      const double sin_u = sin(u);
+      const double cos_u = cos(u);
+      const double sin_2u = 2*cos_u*sin_u;
+      const double cos_2u = cos_u*cos_u - (sin_u*sin_u);
+      const double sin_3u = cos_2u*sin_u + cos_u*sin_2u;
+      const double cos_3u = cos_2u*cos_u - sin_2u*sin_u;
+      const double sin_4u = cos_3u*sin_u + cos_u*sin_3u;
+      const double cos_4u = cos_3u*cos_u - sin_3u*sin_u;
+      const double sin_5u = cos_4u*sin_u + cos_u*sin_4u;
+      const double cos_5u = cos_4u*cos_u - sin_4u*sin_u;
+      const double sin_6u = cos_5u*sin_u + cos_u*sin_5u;
+      const double cos_6u = cos_5u*cos_u - sin_5u*sin_u;
+      const double cos_7u = cos_6u*cos_u - sin_6u*sin_u;
+      const double x0 = -15*sin_u;
+      const double x1 = sin_u*sin_u*sin_u*sin_u;
+      const double x2 = (1 - cos_2u)*(1 - cos_2u);
+      factors[0*stride + i] = -4*sin_3u - x0;
+      factors[1*stride + i] = -5*cos_2u - 2*cos_3u - cos_4u + 15*cos_u;
+      factors[2*stride + i] = 64*((10*sin_2u + 6*sin_3u + 4*sin_4u + x0)*(10*sin_2u + 6*sin_3u + 4*sin_4u + x0));
+      factors[3*stride + i] = 576*((-4*cos_3u + 5*cos_u)*(-4*cos_3u + 5*cos_u));
+      factors[4*stride + i] = (1.0/4.0)*((192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u))*(192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u)));
+      factors[5*stride + i] = 80*sin_2u + 48*sin_3u + 32*sin_4u - 120*sin_u;
+      factors[6*stride + i] = 180*cos_2u - 24*cos_3u*x2 - 63.0/2.0*cos_3u + 30*cos_4u - 42*cos_5u + 16*cos_6u*cos_u - 90*cos_u*x2 + (151.0/2.0)*cos_u - 249;
+      factors[7*stride + i] = 96*cos_3u - 120*cos_u;
+   }
+
+}
+
+void grid_v_factors(double v, double *factors) {
+
+   const double sin_v = sin(v);
+   const double cos_v = cos(v);
+   const double x0 = sin_v*sin_v;
+   const double x1 = 1.0/fabs(sin_v);
+   factors[0] = sin_v;
+   factors[1] = 8*cos_v;
+   factors[2] = x0;
+   factors[3] = cos_v*cos_v;
+   factors[4] = x0*x1;
+   factors[5] = cos_v*sin_v*x1;
+
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void grid_row(size_t n, const double *restrict u_factors, size_t stride, const double *restrict v_factors, double *restrict out_x, double *restrict out_y, double *restrict out_z, double *restrict out_normal_x, double *restrict out_normal_y, double *restrict out_normal_z) {
+
+   const double v_factor0 = v_factors[0];
+   const double v_factor1 = v_factors[1];
+   const double v_factor2 = v_factors[2];
+   const double v_factor3 = v_factors[3];
+   const double v_factor4 = v_factors[4];
+   const double v_factor5 = v_factors[5];
+   for (size_t i = 0; i < n; ++i) {
+      const double u_factor0 = u_factors[0*stride + i];
+      const double u_factor1 = u_factors[1*stride + i];
+      const double u_factor2 = u_factors[2*stride + i];
+      const double u_factor3 = u_factors[3*stride + i];
+      const double u_factor4 = u_factors[4*stride + i];
+      const double u_factor5 = u_factors[5*stride + i];
+      const double u_factor6 = u_factors[6*stride + i];
+      const double u_factor7 = u_factors[7*stride + i];
+      const double x0 = (1.0/sqrt(u_factor2*v_factor2 + u_factor3*v_factor2 + u_factor4*v_factor3));
+      const double x1 = v_factor4*x0;
+      out_x[i] = u_factor0*v_factor0;
+      out_y[i] = v_factor1;
+      out_z[i] = u_factor1*v_factor0;
+      out_normal_x[i] = u_factor5*x1;
+      out_normal_y[i] = u_factor6*v_factor5*x0;
+      out_normal_z[i] = u_factor7*x1;
+   }
+
+}
+
+void grid_u_factorsf(size_t n, const float *restrict us, float *restrict factors, size_t stride) {
+
+   for (size_t i = 0; i < n; ++i) {
+      const float u = us[i];
+      const float sin_u = sinf(u);
+      const float cos_u = cosf(u);
+      const float sin_2u = 2*cos_u*sin_u;
+      const float cos_2u = cos_u*cos_u - (sin_u*sin_u);
+      const float sin_3u = cos_2u*sin_u + cos_u*sin_2u;
+      const float cos_3u = cos_2u*cos_u - sin_2u*sin_u;
+      const float sin_4u = cos_3u*sin_u + cos_u*sin_3u;
+      const float cos_4u = cos_3u*cos_u - sin_3u*sin_u;
+      const float sin_5u = cos_4u*sin_u + cos_u*sin_4u;
+      const float cos_5u = cos_4u*cos_u - sin_4u*sin_u;
+      const float sin_6u = cos_5u*sin_u + cos_u*sin_5u;
+      const float cos_6u = cos_5u*cos_u - sin_5u*sin_u;
+      const float cos_7u = cos_6u*cos_u - sin_6u*sin_u;
+      const float x0 = -15*sin_u;
+      const float x1 = sin_u*sin_u*sin_u*sin_u;
+      const float x2 = (1 - cos_2u)*(1 - cos_2u);
+      factors[0*stride + i] = -4*sin_3u - x0;
+      factors[1*stride + i] = -5*cos_2u - 2*cos_3u - cos_4u + 15*cos_u;
+      factors[2*stride + i] = 64*((10*sin_2u + 6*sin_3u + 4*sin_4u + x0)*(10*sin_2u + 6*sin_3u + 4*sin_4u + x0));
+      factors[3*stride + i] = 576*((-4*cos_3u + 5*cos_u)*(-4*cos_3u + 5*cos_u));
+      factors[4*stride + i] = (1.0F/4.0F)*((192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u))*(192*cos_3u*x1 + 63*cos_3u + 68*cos_5u - 16*cos_7u + 720*cos_u*x1 - 151*cos_u - 480*x1 + 78 + 1200*(sin_u*sin_u)));
+      factors[5*stride + i] = 80*sin_2u + 48*sin_3u + 32*sin_4u - 120*sin_u;
+      factors[6*stride + i] = 180*cos_2u - 24*cos_3u*x2 - 63.0F/2.0F*cos_3u + 30*cos_4u - 42*cos_5u + 16*cos_6u*cos_u - 90*cos_u*x2 + (151.0F/2.0F)*cos_u - 249;
+      factors[7*stride + i] = 96*cos_3u - 120*cos_u;
+   }
+
+}
+
+void grid_v_factorsf(float v, float *factors) {
+
+   const float sin_v = sinf(v);
+   const float cos_v = cosf(v);
+   const float x0 = sin_v*sin_v;
+   const float x1 = 1.0F/fabsf(sin_v);
+   factors[0] = sin_v;
+   factors[1] = 8*cos_v;
+   factors[2] = x0;
+   factors[3] = cos_v*cos_v;
+   factors[4] = x0*x1;
+   factors[5] = cos_v*sin_v*x1;
+
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void grid_rowf(size_t n, const float *restrict u_factors, size_t stride, const float *restrict v_factors, float *restrict out_x, float *restrict out_y, float *restrict out_z, float *restrict out_normal_x, float *restrict out_normal_y, float *restrict out_normal_z) {
+
+   const float v_factor0 = v_factors[0];
+   const float v_factor1 = v_factors[1];
+   const float v_factor2 = v_factors[2];
+   const float v_factor3 = v_factors[3];
+   const float v_factor4 = v_factors[4];
+   const float v_factor5 = v_factors[5];
+   for (size_t i = 0; i < n; ++i) {
+      const float u_factor0 = u_factors[0*stride + i];
+      const float u_factor1 = u_factors[1*stride + i];
+      const float u_factor2 = u_factors[2*stride + i];
+      const float u_factor3 = u_factors[3*stride + i];
+      const float u_factor4 = u_factors[4*stride + i];
+      const float u_factor5 = u_factors[5*stride + i];
+      const float u_factor6 = u_factors[6*stride + i];
+      const float u_factor7 = u_factors[7*stride + i];
+      const float x0 = (1.0F/sqrtf(u_factor2*v_factor2 + u_factor3*v_factor2 + u_factor4*v_factor3));
+      const float x1 = v_factor4*x0;
+      out_x[i] = u_factor0*v_factor0;
+      out_y[i] = v_factor1;
+      out_z[i] = u_factor1*v_factor0;
+      out_normal_x[i] = u_factor5*x1;
+      out_normal_y[i] = u_factor6*v_factor5*x0;
+      out_normal_z[i] = u_factor7*x1;
+   }
+
+}
@@ -0,0 +1,24 @@
+/******************************************************************************
+ *                   Code generated with src/codegen/generate.py              *
+ *                                                                            *
+ *                      This file is part of 'renderer'                       *
+ ******************************************************************************/
+
+
+#ifndef RENDERER__SURFACE_GRID__H
+#define RENDERER__SURFACE_GRID__H
+
+#include <stddef.h>
+
+#define GRID_U_FACTORS 8
+#define GRID_V_FACTORS 6
+
+void grid_u_factors(size_t n, const double *us, double *factors, size_t stride);
+void grid_v_factors(double v, double *factors);
+void grid_row(size_t n, const double *u_factors, size_t stride, const double *v_factors, double *out_x, double *out_y, double *out_z, double *out_normal_x, double *out_normal_y, double *out_normal_z);
+void grid_u_factorsf(size_t n, const float *us, float *factors, size_t stride);
+void grid_v_factorsf(float v, float *factors);
+void grid_rowf(size_t n, const float *u_factors, size_t stride, const float *v_factors, float *out_x, float *out_y, float *out_z, float *out_normal_x, float *out_normal_y, float *out_normal_z);
+
+#endif
+
@@ -2,71 +2,96 @@
 
 #include <array>
 #include <cmath>
+#include <concepts>
+#include <type_traits>
+
+// Vectors and matrices are generic over the scalar type `T`. `vec` and `mat`
+// aliases use `real`, the scalar type the renderer is built with (see
+// `RENDERER_PRECISION` in CMakeLists.txt).
+template <typename T, size_t N>
+using basic_vec = std::array<T, N>;
+
+template <typename T, size_t N, size_t M>
+using basic_mat = std::array<basic_vec<T, M>, N>;
+
+#ifdef RENDERER_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
 
 template <size_t N>
-using vec = std::array<double, N>;
+using vec = basic_vec<real, N>;
 
 template <size_t N, size_t M>
-using mat = std::array<vec<M>, N>;
+using mat = basic_mat<real, N, M>;
 
-template <size_t N>
-constexpr vec<N> operator+(vec<N> a, vec<N> b) {
-    vec<N> result;
+// Scalar arguments are not used to deduce `T` (`std::type_identity_t`), so that
+// e.g. `2.0 * v` works for vectors of floats too.
+template <typename T>
+using scalar_of = std::type_identity_t<T>;
+
+// Operations below are constrained to floating point element types, so that
+// element-wise vector operations don't match matrices (arrays of vectors).
+
+template <std::floating_point T, size_t N>
+constexpr basic_vec<T, N> operator+(basic_vec<T, N> a, basic_vec<T, N> b) {
+    basic_vec<T, N> result;
     for (size_t i = 0; i < N; ++i) {
         result[i] = a[i] + b[i];
     }
     return result;
 }
 
-template <size_t N>
-constexpr vec<N> operator-(vec<N> a, vec<N> b) {
-    vec<N> result;
+template <std::floating_point T, size_t N>
+constexpr basic_vec<T, N> operator-(basic_vec<T, N> a, basic_vec<T, N> b) {
+    basic_vec<T, N> result;
     for (size_t i = 0; i < N; ++i) {
         result[i] = a[i] - b[i];
     }
     return result;
 }
 
-template <size_t N>
-constexpr vec<N> operator*(double a, vec<N> b) {
-    vec<N> result;
+template <std::floating_point T, size_t N>
+constexpr basic_vec<T, N> operator*(scalar_of<T> a, basic_vec<T, N> b) {
+    basic_vec<T, N> result;
     for (size_t i = 0; i < N; ++i) {
         result[i] = a * b[i];
     }
     return result;
 }
 
-template <size_t N>
-constexpr vec<N> operator*(vec<N> a, double b) {
+template <std::floating_point T, size_t N>
+constexpr basic_vec<T, N> operator*(basic_vec<T, N> a, scalar_of<T> b) {
     return b * a;
 }
 
-template <size_t N>
-constexpr vec<N> operator/(vec<N> a, double b) {
-    return (1.0 / b) * a;
+template <std::floating_point T, size_t N>
+constexpr basic_vec<T, N> operator/(basic_vec<T, N> a, scalar_of<T> b) {
+    return (T(1) / b) * a;
 }
 
-template <size_t N>
-constexpr double dot(vec<N> a, vec<N> b) {
-    double result = 0.0;
+template <std::floating_point T, size_t N>
+constexpr T dot(basic_vec<T, N> a, basic_vec<T, N> b) {
+    T result = 0;
     for (size_t i = 0; i < N; ++i) {
         result += a[i] * b[i];
     }
     return result;
 }
 
-template <size_t N>
-constexpr vec<N> operator*(vec<N> a, vec<N> b) {
-    vec<N> result;
+template <std::floating_point T, size_t N>
+constexpr basic_vec<T, N> operator*(basic_vec<T, N> a, basic_vec<T, N> b) {
+    basic_vec<T, N> result;
     for (size_t i = 0; i < N; ++i) {
         result[i] = a[i] * b[i];
     }
     return result;
 }
 
-template <size_t N, size_t M>
-constexpr vec<N> operator*(mat<N, M> a, vec<M> b) {
-    vec<N> result = {};
+template <std::floating_point T, size_t N, size_t M>
+constexpr basic_vec<T, N> operator*(basic_mat<T, N, M> a, basic_vec<T, M> b) {
+    basic_vec<T, N> result = {};
     for (size_t i = 0; i < N; ++i) {
         for (size_t j = 0; j < M; ++j) {
             result[i] += a[i][j] * b[j];
@@ -75,9 +100,9 @@ constexpr vec<N> operator*(mat<N, M> a, vec<M> b) {
     return result;
 }
 
-template <size_t N, size_t M, size_t K>
-constexpr mat<N, K> operator*(mat<N, M> a, mat<M, K> b) {
-    mat<N, K> result = {};
+template <std::floating_point T, size_t N, size_t M, size_t K>
+constexpr basic_mat<T, N, K> operator*(basic_mat<T, N, M> a, basic_mat<T, M, K> b) {
+    basic_mat<T, N, K> result = {};
     for (size_t i = 0; i < N; ++i) {
         for (size_t j = 0; j < K; ++j) {
             for (size_t k = 0; k < M; ++k) {
@@ -88,130 +113,151 @@ constexpr mat<N, K> operator*(mat<N, M> a, mat<M, K> b) {
     return result;
 }
 
-template<size_t N>
-constexpr double length(vec<N> v) {
+template <std::floating_point T, size_t N>
+constexpr T length(basic_vec<T, N> v) {
     return std::sqrt(dot(v, v));
 }
 
-template<size_t N>
-constexpr vec<N> normalize(vec<N> v) {
+template <std::floating_point T, size_t N>
+constexpr basic_vec<T, N> normalize(basic_vec<T, N> v) {
     return v / length(v);
 }
 
-inline vec<4> to_homogeneus(vec<3> v) {
-    return vec<4>{v[0], v[1], v[2], 1.0};
+template <std::floating_point T>
+inline basic_vec<T, 4> to_homogeneus(basic_vec<T, 3> v) {
+    return basic_vec<T, 4>{v[0], v[1], v[2], 1};
 }
 
-inline vec<3> from_homogeneus(vec<4> v) {
-    return vec<3>{v[0] / v[3], v[1] / v[3], v[2] / v[3]};
+template <std::floating_point T>
+inline basic_vec<T, 3> from_homogeneus(basic_vec<T, 4> v) {
+    return basic_vec<T, 3>{v[0] / v[3], v[1] / v[3], v[2] / v[3]};
 }
 
-inline vec<2> from_homogeneus(vec<3> v) {
-    return vec<2>{v[0] / v[2], v[1] / v[2]};
+template <std::floating_point T>
+inline basic_vec<T, 2> from_homogeneus(basic_vec<T, 3> v) {
+    return basic_vec<T, 2>{v[0] / v[2], v[1] / v[2]};
 }
 
-inline mat<4,4> scale(double factor) {
-    return mat<4,4>{{
-        {factor, 0.0, 0.0, 0.0},
-        {0.0, factor, 0.0, 0.0},
-        {0.0, 0.0, factor, 0.0},
-        {0.0, 0.0, 0.0, 1.0}
+template <std::floating_point T = real>
+inline basic_mat<T, 4, 4> scale(scalar_of<T> factor) {
+    return basic_mat<T, 4, 4>{{
+        {factor, 0, 0, 0},
+        {0, factor, 0, 0},
+        {0, 0, factor, 0},
+        {0, 0, 0, 1}
     }};
 }
 
-inline mat<4,4> rotate_along_y(double angle) {
-    return mat<4,4>{{
-        {std::cos(angle), 0.0, std::sin(angle), 0.0},
-        {0.0, 1.0, 0.0, 0.0},
-        {-std::sin(angle), 0.0, std::cos(angle), 0.0},
-        {0.0, 0.0, 0.0, 1.0}
+template <std::floating_point T = real>
+inline basic_mat<T, 4, 4> rotate_along_y(scalar_of<T> angle) {
+    return basic_mat<T, 4, 4>{{
+        {std::cos(angle), 0, std::sin(angle), 0},
+        {0, 1, 0, 0},
+        {-std::sin(angle), 0, std::cos(angle), 0},
+        {0, 0, 0, 1}
     }};
 }
 
-inline mat<4,4> rotate_along_x(double angle) {
-    return mat<4,4>{{
-        {1.0, 0.0, 0.0, 0.0},
-        {0.0, std::cos(angle), -std::sin(angle), 0.0},
-        {0.0, std::sin(angle), std::cos(angle), 0.0},
-        {0.0, 0.0, 0.0, 1.0}
+template <std::floating_point T = real>
+inline basic_mat<T, 4, 4> rotate_along_x(scalar_of<T> angle) {
+    return basic_mat<T, 4, 4>{{
+        {1, 0, 0, 0},
+        {0, std::cos(angle), -std::sin(angle), 0},
+        {0, std::sin(angle), std::cos(angle), 0},
+        {0, 0, 0, 1}
     }};
 }
 
-inline mat<4,4> translate(vec<3> offset) {
-    return mat<4,4>{{
-        {1.0, 0.0, 0.0, offset[0]},
-        {0.0, 1.0, 0.0, offset[1]},
-        {0.0, 0.0, 1.0, offset[2]},
-        {0.0, 0.0, 0.0, 1.0}
+template <std::floating_point T>
+inline basic_mat<T, 4, 4> translate(basic_vec<T, 3> offset) {
+    return basic_mat<T, 4, 4>{{
+        {1, 0, 0, offset[0]},
+        {0, 1, 0, offset[1]},
+        {0, 0, 1, offset[2]},
+        {0, 0, 0, 1}
     }};
 }
 
 // See the image at https://math.stackexchange.com/q/13261.
-inline vec<4> reflect(vec<4> ray, vec<4> normal) {
+template <std::floating_point T>
+inline basic_vec<T, 4> reflect(basic_vec<T, 4> ray, basic_vec<T, 4> normal) {
     return ray - 2 * dot(ray, normal) * normal;
 }
 
 namespace test {
-    // Test vector addition.
-    static_assert(
-        vec<3>{1.0, 2.0, 3.0} + vec<3>{4.0, 5.0, 6.0} == vec<3>{5.0, 7.0, 9.0},
-        "vector addition is incorrect"
-    );
-
-    // Test vector subtraction.
-    static_assert(
-        vec<3>{1.0, 2.0, 3.0} - vec<3>{4.0, 5.0, 6.0} == vec<3>{-3.0, -3.0, -3.0},
-        "vector subtraction is incorrect"
-    );
-
-    // Test scalar multiplication.
-    static_assert(
-        2.0 * vec<3>{1.0, 2.0, 3.0} == vec<3>{2.0, 4.0, 6.0},
-        "scalar multiplication is incorrect"
-    );
-
-    // Test scalar multiplication.
-    static_assert(
-        vec<3>{1.0, 2.0, 3.0} * 2.0 == vec<3>{2.0, 4.0, 6.0},
-        "scalar multiplication is incorrect"
-    );
-
-    // Test scalar division.
-    static_assert(
-        vec<3>{2.0, 4.0, 6.0} / 2.0 == vec<3>{1.0, 2.0, 3.0},
-        "scalar division is incorrect"
-    );
-
-    // Test dot product.
-    static_assert(
-        dot(vec<3>{1.0, 2.0, 3.0}, vec<3>{4.0, 5.0, 6.0}) == 32.0,
-        "dot product of two vectors is incorrect"
-    );
-
-    // Test matrix-vector multiplication usig a 2x3 matrix.
-    static_assert(
-        mat<2, 3>{{
-           {1.0, 2.0, 3.0},
-           {4.0, 5.0, 6.0}
-        }} * vec<3>{1.0, 2.0, 3.0} == vec<2>{14.0, 32.0},
-        "matrix-vector multiplication is incorrect"
-    );
-
-    // Test matrix-matrix multiplication.
-    static_assert(
-        mat<3, 3>{{
-           {1.0, 2.0, 3.0},
-           {4.0, 5.0, 6.0},
-           {7.0, 8.0, 9.0}
-        }} * mat<3, 3>{{
-           {1.0, 2.0, 3.0},
-           {4.0, 5.0, 6.0},
-           {7.0, 8.0, 9.0}
-        }} == mat<3, 3>{{
-           {30.0, 36.0, 42.0},
-           {66.0, 81.0, 96.0},
-           {102.0, 126.0, 150.0}
-        }},
-        "matrix-matrix multiplication is incorrect"
-    );
-}
\ No newline at end of file
+    // Tests are run for both scalar types the renderer can be built with (see
+    // the explicit instantiations below).
+    template <typename T>
+    struct linalg {
+        template <size_t N>
+        using vec = basic_vec<T, N>;
+
+        template <size_t N, size_t M>
+        using mat = basic_mat<T, N, M>;
+        // Test vector addition.
+        static_assert(
+            vec<3>{1.0, 2.0, 3.0} + vec<3>{4.0, 5.0, 6.0} == vec<3>{5.0, 7.0, 9.0},
+            "vector addition is incorrect"
+        );
+
+        // Test vector subtraction.
+        static_assert(
+            vec<3>{1.0, 2.0, 3.0} - vec<3>{4.0, 5.0, 6.0} == vec<3>{-3.0, -3.0, -3.0},
+            "vector subtraction is incorrect"
+        );
+
+        // Test scalar multiplication.
+        static_assert(
+            2.0 * vec<3>{1.0, 2.0, 3.0} == vec<3>{2.0, 4.0, 6.0},
+            "scalar multiplication is incorrect"
+        );
+
+        // Test scalar multiplication.
+        static_assert(
+            vec<3>{1.0, 2.0, 3.0} * 2.0 == vec<3>{2.0, 4.0, 6.0},
+            "scalar multiplication is incorrect"
+        );
+
+        // Test scalar division.
+        static_assert(
+            vec<3>{2.0, 4.0, 6.0} / 2.0 == vec<3>{1.0, 2.0, 3.0},
+            "scalar division is incorrect"
+        );
+
+        // Test dot product.
+        static_assert(
+            dot(vec<3>{1.0, 2.0, 3.0}, vec<3>{4.0, 5.0, 6.0}) == 32.0,
+            "dot product of two vectors is incorrect"
+        );
+
+        // Test matrix-vector multiplication usig a 2x3 matrix.
+        static_assert(
+            mat<2, 3>{{
+               {1.0, 2.0, 3.0},
+               {4.0, 5.0, 6.0}
+            }} * vec<3>{1.0, 2.0, 3.0} == vec<2>{14.0, 32.0},
+            "matrix-vector multiplication is incorrect"
+        );
+
+        // Test matrix-matrix multiplication.
+        static_assert(
+            mat<3, 3>{{
+               {1.0, 2.0, 3.0},
+               {4.0, 5.0, 6.0},
+               {7.0, 8.0, 9.0}
+            }} * mat<3, 3>{{
+               {1.0, 2.0, 3.0},
+               {4.0, 5.0, 6.0},
+               {7.0, 8.0, 9.0}
+            }} == mat<3, 3>{{
+               {30.0, 36.0, 42.0},
+               {66.0, 81.0, 96.0},
+               {102.0, 126.0, 150.0}
+            }},
+            "matrix-matrix multiplication is incorrect"
+        );
+    };
+
+    template struct linalg<double>;
+    template struct linalg<float>;
+}
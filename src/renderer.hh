@@ -0,0 +1,3993 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numbers>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "linalg.hh"
+#include "thread_pool.hh"
+
+using std::numbers::pi;
+
+// Represents an image with pixels of type `vec<3>`.
+// Colors are represented as RGB vectors with values in the range [0, 1].
+class image {
+public:
+    image(size_t width, size_t height) : _width(width), _height(height) {
+        _pixels.resize(width * height);
+    }
+
+    vec<3>& operator()(size_t x, size_t y) {
+        return _pixels[x + y * _width];
+    }
+
+    size_t width() const {
+        return _width;
+    }
+
+    size_t height() const {
+        return _height;
+    }
+
+    // Clears the image by setting all pixels to black.
+    void clear() {
+        std::fill(_pixels.begin(), _pixels.end(), vec<3>{0, 0, 0});
+    }
+
+    const vec<3>& operator()(size_t x, size_t y) const {
+        return _pixels[x + y * _width];
+    }
+
+    // Returns all pixels of the image, row by row.
+    std::span<vec<3>> pixels() {
+        return _pixels;
+    }
+
+    std::span<const vec<3>> pixels() const {
+        return _pixels;
+    }
+
+private:
+    std::vector<vec<3>> _pixels;
+    size_t _width;
+    size_t _height;
+};
+
+// Writes the whole `data` buffer to the file descriptor `fd`.
+//
+// `write` is allowed to write less than requested (which happens all the time
+// with pipes), so it is called until everything is written.
+inline void write_all(int fd, std::span<const unsigned char> data) {
+    while (!data.empty()) {
+        ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+        data = data.subspan(static_cast<size_t>(written));
+    }
+}
+
+// Destination of a rendered stream.
+//
+// By default, data is written to the file descriptor as it is. A `chunked`
+// stream (used by the render server, see `src/server.hh`) precedes every
+// piece of data with a line holding its size in bytes and ends with an empty
+// chunk (a `0` line), so that a client reading many streams from a single
+// connection can tell where each of them ends.
+class output_stream {
+public:
+    explicit output_stream(int fd = STDOUT_FILENO, bool chunked = false)
+    : _fd(fd), _chunked(chunked) {
+        struct stat status;
+        if (::fstat(fd, &status) == 0 && S_ISFIFO(status.st_mode)) {
+            int size = ::fcntl(fd, F_GETPIPE_SZ);
+            _pipe_size = size > 0 ? static_cast<size_t>(size) : 0;
+        }
+    }
+
+    // Writes `data`. With `splice`, if the stream is a pipe and `data` is at
+    // least as large as the pipe's buffer, its pages are handed over to the
+    // pipe with `vmsplice` instead of being copied (see `frame_output` for
+    // when that is safe).
+    void write(std::span<const unsigned char> data, bool splice = false) {
+        if (_chunked) {
+            if (data.empty()) {
+                // An empty chunk would end the stream.
+                return;
+            }
+            write_line(std::to_string(data.size()));
+        }
+        if (splice && splices(data.size())) {
+            splice_all(data);
+        } else {
+            write_all(_fd, data);
+        }
+    }
+
+    // Whether `size` bytes written with `splice` would be spliced.
+    bool splices(size_t size) const {
+        return _pipe_size > 0 && size >= _pipe_size;
+    }
+
+    void write(std::string_view data) {
+        write(std::span(reinterpret_cast<const unsigned char*>(data.data()), data.size()));
+    }
+
+    // Ends the stream. Does nothing unless it is chunked.
+    void finish() {
+        if (_chunked) {
+            write_line("0");
+        }
+    }
+
+private:
+    void write_line(std::string line) {
+        line += '\n';
+        write_all(_fd, std::span(reinterpret_cast<const unsigned char*>(line.data()), line.size()));
+    }
+
+    // Splices `data` into the pipe. Falls back to `write` (for good) if the
+    // kernel doesn't support `vmsplice` on the file descriptor.
+    void splice_all(std::span<const unsigned char> data) {
+        while (!data.empty()) {
+            iovec pages{const_cast<unsigned char*>(data.data()), data.size()};
+            ssize_t spliced = ::vmsplice(_fd, &pages, 1, 0);
+            if (spliced < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EINVAL || errno == ENOSYS || errno == EBADF) {
+                    _pipe_size = 0;
+                    write_all(_fd, data);
+                    return;
+                }
+                throw std::system_error(errno, std::generic_category(), "vmsplice");
+            }
+            data = data.subspan(static_cast<size_t>(spliced));
+        }
+    }
+
+    int _fd;
+    bool _chunked;
+
+    // Size of the pipe's buffer if the stream is a pipe, and 0 otherwise.
+    size_t _pipe_size = 0;
+};
+
+// Writes frames to an `output_stream` on a separate thread, so that the
+// renderer can go on with the next frame while the previous one is being
+// written (e.g. while ffmpeg is slow to read it).
+//
+// With `render_settings::splice`, frames written to a pipe are spliced into
+// it (see `output_stream::write`): the pipe refers to the frame's memory until
+// the reader takes the data out, and the frame must not change until then.
+// A reader that copies the data out (with `read`) has taken out whatever was
+// in the pipe before once a whole pipe's worth of data has been written after
+// it. A reader that moves the pages on with `splice` or `tee` (e.g. `pv`)
+// still refers to them after that, and would see them overwritten by later
+// frames, which is why splicing is off by default. Frames are spliced only if
+// all of them have the same size (`splice`), which has to be at least the
+// size of the pipe's buffer, and the memory of a frame is reused (or freed)
+// only after the next frame was written:
+// - `send` waits for the previous frame to be written before it starts
+//   writing the next one, so the caller can alternate between two buffers,
+//   waiting (with `wait`) before encoding a frame into the buffer sent two
+//   frames ago,
+// - the last frame is copied, so that nothing refers to the frames once the
+//   stream is finished.
+class frame_output {
+public:
+    frame_output(output_stream& output, bool splice)
+    : _output(output), _splice(splice), _thread([this] { work(); }) {}
+
+    frame_output(const frame_output&) = delete;
+    frame_output& operator=(const frame_output&) = delete;
+
+    ~frame_output() {
+        {
+            std::lock_guard lock(_mutex);
+            _stopping = true;
+        }
+        _changed.notify_all();
+    }
+
+    // Waits until the frame sent before is written, and starts writing `data`
+    // (which must not change until the next frame is written). `owner` is
+    // kept alive until then. Rethrows errors of writing the previous frame.
+    void send(std::span<const unsigned char> data, bool last, std::shared_ptr<const void> owner = nullptr) {
+        wait();
+        std::lock_guard lock(_mutex);
+        _owners[1] = std::move(_owners[0]);
+        _owners[0] = std::move(owner);
+        _data = data;
+        _last = last;
+        _pending = true;
+        _changed.notify_all();
+    }
+
+    // Waits until the frame sent last is written, and rethrows the error if
+    // writing it failed.
+    void wait() {
+        std::unique_lock lock(_mutex);
+        _changed.wait(lock, [this] { return !_pending; });
+        if (_error) {
+            std::rethrow_exception(std::exchange(_error, nullptr));
+        }
+    }
+
+private:
+    void work() {
+        std::unique_lock lock(_mutex);
+        while (true) {
+            _changed.wait(lock, [this] { return _stopping || _pending; });
+            if (_stopping) {
+                return;
+            }
+
+            lock.unlock();
+            std::exception_ptr error;
+            try {
+                _output.write(_data, _splice && !_last);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            lock.lock();
+
+            _error = error;
+            _pending = false;
+            _changed.notify_all();
+        }
+    }
+
+    output_stream& _output;
+    bool _splice;
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+
+    // Frame being written, and whether it is the last one.
+    std::span<const unsigned char> _data;
+    bool _last = false;
+    bool _pending = false;
+    bool _stopping = false;
+    std::exception_ptr _error;
+
+    // Owners of the last two frames sent.
+    std::array<std::shared_ptr<const void>, 2> _owners;
+
+    // Started last, once everything it uses is initialized, and joined first.
+    std::jthread _thread;
+};
+
+// Represents a depth buffer.
+//
+// The depth buffer is used to keep track of the closest point to the camera at
+// each pixel. The depth buffer is initialized with the maximum possible depth at
+// each pixel. When a point is drawn at a pixel, its depth is compared to the
+// depth stored in the buffer. If the point is closer to the camera, it is
+// drawn, and its depth is stored in the buffer.
+class z_buffer {
+public:
+    z_buffer(size_t width, size_t height) : _width(width) {
+        _pixels.resize(width * height);
+        clear();
+    }
+
+    real& operator()(size_t x, size_t y) {
+        return _pixels[x + y * _width];
+    }
+
+    // Returns depths of all pixels, row by row.
+    std::span<real> pixels() {
+        return _pixels;
+    }
+
+    std::span<const real> pixels() const {
+        return _pixels;
+    }
+
+    void clear() {
+        std::fill(_pixels.begin(), _pixels.end(), std::numeric_limits<real>::max());
+    }
+private:
+    std::vector<real> _pixels;
+    size_t _width;
+};
+
+// Maps a color channel value in range [0, 1] to a byte.
+inline unsigned char quantize(real value) {
+    return static_cast<unsigned char>(std::clamp(static_cast<int>(value * 256), 0, 255));
+}
+
+// A framebuffer made of separate color and depth buffers.
+//
+// Colors (or normals, when shading is deferred) are kept at full precision
+// until the frame is encoded.
+struct split_framebuffer {
+    split_framebuffer(size_t width, size_t height) : img(width, height), depth(width, height) {}
+
+    size_t width() const {
+        return img.width();
+    }
+
+    size_t height() const {
+        return img.height();
+    }
+
+    void clear() {
+        img.clear();
+        depth.clear();
+    }
+
+    // Whether a point at depth `z` is hidden by the one already drawn at
+    // (x, y). A point replaces the previous one at equal depth.
+    bool occluded(size_t x, size_t y, real z) {
+        return depth(x, y) < z;
+    }
+
+    void store_color(size_t x, size_t y, real z, const vec<3>& color) {
+        depth(x, y) = z;
+        img(x, y) = color;
+    }
+
+    void store_normal(size_t x, size_t y, real z, const vec<3>& normal) {
+        store_color(x, y, z, normal);
+    }
+
+    // Whether the point drawn at (x, y) has the depth `z` (as far as the
+    // framebuffer can tell).
+    bool same_depth(size_t x, size_t y, real z) {
+        return depth(x, y) == z;
+    }
+
+    // Whether any point was drawn at (x, y).
+    bool covered(size_t x, size_t y) {
+        return depth(x, y) != std::numeric_limits<real>::max();
+    }
+
+    // Depth of the point drawn at (x, y), or the maximum value of `real` if
+    // there is none.
+    real stored_depth(size_t x, size_t y) {
+        return depth(x, y);
+    }
+
+    // Copies the depth and the color of pixel (from_x, from_y) to (x, y).
+    void copy_pixel(size_t from_x, size_t from_y, size_t x, size_t y) {
+        depth(x, y) = depth(from_x, from_y);
+        img(x, y) = img(from_x, from_y);
+    }
+
+    // Normal stored at (x, y) by `store_normal`.
+    vec<3> normal(size_t x, size_t y) {
+        return img(x, y);
+    }
+
+    // Replaces the normal stored at (x, y) with a color.
+    void set_color(size_t x, size_t y, const vec<3>& color) {
+        img(x, y) = color;
+    }
+
+    // Takes pixels [begin, end) (counting row by row) of `other` where they
+    // are not further away than the pixels of this framebuffer.
+    void merge(const split_framebuffer& other, size_t begin, size_t end) {
+        auto colors = img.pixels();
+        auto depths = depth.pixels();
+        auto other_colors = other.img.pixels();
+        auto other_depths = other.depth.pixels();
+        for (size_t p = begin; p < end; ++p) {
+            if (other_depths[p] <= depths[p]) {
+                depths[p] = other_depths[p];
+                colors[p] = other_colors[p];
+            }
+        }
+    }
+
+    image img;
+    z_buffer depth;
+};
+
+// A framebuffer storing the depth and the color of a pixel together, in a
+// single 64-bit word.
+//
+// The upper half of the word holds the depth converted to `float`, with its
+// bits rearranged so that comparing them as unsigned integers orders the
+// depths (see `depth_key`). The lower half holds the color quantized to 8 bits
+// per channel, or, while shading is deferred, the normal in octahedral
+// encoding (see https://jcgt.org/published/0003/02/01/, section 3.3) with 16
+// bits per coordinate.
+//
+// Drawing a point loads, compares and stores a single word, and the whole
+// framebuffer takes 8 bytes per pixel instead of 8 + 3 * sizeof(real). The
+// price is precision: depths closer than `float` can tell apart, and normals
+// closer than the encoding can tell apart, are the same here.
+class packed_framebuffer {
+public:
+    packed_framebuffer(size_t width, size_t height) : _width(width), _height(height) {
+        _pixels.resize(width * height);
+        clear();
+    }
+
+    size_t width() const {
+        return _width;
+    }
+
+    size_t height() const {
+        return _height;
+    }
+
+    void clear() {
+        std::fill(_pixels.begin(), _pixels.end(), empty);
+    }
+
+    bool occluded(size_t x, size_t y, real z) {
+        return (word(x, y) >> 32) < depth_key(z);
+    }
+
+    void store_color(size_t x, size_t y, real z, const vec<3>& color) {
+        word(x, y) = uint64_t{depth_key(z)} << 32 | pack_color(color);
+    }
+
+    void store_normal(size_t x, size_t y, real z, const vec<3>& normal) {
+        word(x, y) = uint64_t{depth_key(z)} << 32 | pack_normal(normal);
+    }
+
+    bool same_depth(size_t x, size_t y, real z) {
+        return (word(x, y) >> 32) == depth_key(z);
+    }
+
+    bool covered(size_t x, size_t y) {
+        return (word(x, y) >> 32) != (empty >> 32);
+    }
+
+    // Depth of the point drawn at (x, y) (as `float`), or the maximum value
+    // of `float` if there is none.
+    real stored_depth(size_t x, size_t y) {
+        auto key = static_cast<uint32_t>(word(x, y) >> 32);
+        return std::bit_cast<float>((key & 0x80000000) ? key & 0x7fffffff : ~key);
+    }
+
+    void copy_pixel(size_t from_x, size_t from_y, size_t x, size_t y) {
+        word(x, y) = word(from_x, from_y);
+    }
+
+    vec<3> normal(size_t x, size_t y) {
+        return unpack_normal(static_cast<uint32_t>(word(x, y)));
+    }
+
+    void set_color(size_t x, size_t y, const vec<3>& color) {
+        word(x, y) = (word(x, y) & ~uint64_t{0xffffffff}) | pack_color(color);
+    }
+
+    void merge(const packed_framebuffer& other, size_t begin, size_t end) {
+        for (size_t p = begin; p < end; ++p) {
+            if ((other._pixels[p] >> 32) <= (_pixels[p] >> 32)) {
+                _pixels[p] = other._pixels[p];
+            }
+        }
+    }
+
+    // Color of pixel `i` (counting row by row).
+    std::array<unsigned char, 3> color(size_t i) const {
+        uint64_t pixel = _pixels[i];
+        return {
+            static_cast<unsigned char>(pixel),
+            static_cast<unsigned char>(pixel >> 8),
+            static_cast<unsigned char>(pixel >> 16)
+        };
+    }
+
+private:
+    // Maps a depth to an unsigned integer, so that smaller depths give
+    // smaller integers. Non-negative floats already compare like their bits
+    // do (once the sign bit is set), and negative floats compare in reverse
+    // (so all their bits are flipped).
+    static uint32_t depth_key(real z) {
+        auto bits = std::bit_cast<uint32_t>(static_cast<float>(z));
+        return (bits & 0x80000000) ? ~bits : bits | 0x80000000;
+    }
+
+    static uint32_t pack_color(const vec<3>& color) {
+        return uint32_t{quantize(color[0])}
+            | uint32_t{quantize(color[1])} << 8
+            | uint32_t{quantize(color[2])} << 16;
+    }
+
+    // The normal is projected onto the octahedron |x| + |y| + |z| = 1, whose
+    // lower half is folded over the upper one, and the (x, y) coordinates of
+    // the projection (in [-1, 1]) are stored.
+    static uint32_t pack_normal(const vec<3>& normal) {
+        real scale = 1 / (std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]));
+        real x = normal[0] * scale;
+        real y = normal[1] * scale;
+        if (normal[2] < 0) {
+            real folded_x = (1 - std::abs(y)) * (x < 0 ? -1 : 1);
+            real folded_y = (1 - std::abs(x)) * (y < 0 ? -1 : 1);
+            x = folded_x;
+            y = folded_y;
+        }
+
+        auto coordinate = [](real value) {
+            // Rounds to the nearest integer (the value is never negative).
+            return static_cast<uint32_t>((std::clamp(value, real(-1), real(1)) + 1) * real(32767.5) + real(0.5));
+        };
+        return coordinate(x) | coordinate(y) << 16;
+    }
+
+    static vec<3> unpack_normal(uint32_t packed) {
+        auto coordinate = [](uint32_t value) {
+            return static_cast<real>(value & 0xffff) / real(32767.5) - 1;
+        };
+        real x = coordinate(packed);
+        real y = coordinate(packed >> 16);
+        real z = 1 - std::abs(x) - std::abs(y);
+        if (z < 0) {
+            real unfolded_x = (1 - std::abs(y)) * (x < 0 ? -1 : 1);
+            real unfolded_y = (1 - std::abs(x)) * (y < 0 ? -1 : 1);
+            x = unfolded_x;
+            y = unfolded_y;
+        }
+        return normalize(vec<3>{x, y, z});
+    }
+
+    uint64_t& word(size_t x, size_t y) {
+        return _pixels[x + y * _width];
+    }
+
+    // Black pixel as far away as possible.
+    static constexpr uint64_t empty = uint64_t{0xff7fffff} << 32;
+
+    std::vector<uint64_t> _pixels;
+    size_t _width;
+    size_t _height;
+};
+
+// Hierarchical depth buffer (hi-z) of a framebuffer: the largest depth stored
+// in every block of 4 x 4 pixels, then in every block of 8 x 8 pixels, and so
+// on, up to a single block covering the whole frame.
+//
+// If the largest depth of a block is smaller than the depth of a point, the
+// point is hidden wherever in the block it falls. Whole groups of points can
+// be rejected that way at once (see `renderer::render_culled_rows`). Depths in
+// a framebuffer can only decrease, so a pyramid stays valid (only less tight)
+// while more points are drawn after it was built.
+class depth_pyramid {
+public:
+    // Recomputes the pyramid from the depths stored in `frame`.
+    template <typename Framebuffer>
+    void build(Framebuffer& frame) {
+        size_t shift = first_shift;
+        size_t columns = (frame.width() + (size_t{1} << shift) - 1) >> shift;
+        size_t rows = (frame.height() + (size_t{1} << shift) - 1) >> shift;
+        _levels.resize(1);
+        _levels[0] = {shift, columns, rows, {}};
+        _levels[0].depths.assign(columns * rows, std::numeric_limits<real>::lowest());
+        for (size_t y = 0; y < frame.height(); ++y) {
+            real* blocks = _levels[0].depths.data() + (y >> shift) * columns;
+            for (size_t x = 0; x < frame.width(); ++x) {
+                blocks[x >> shift] = std::max(blocks[x >> shift], frame.stored_depth(x, y));
+            }
+        }
+
+        while (columns > 1 || rows > 1) {
+            const level& finer = _levels.back();
+            level coarser{finer.shift + 1, (columns + 1) / 2, (rows + 1) / 2, {}};
+            coarser.depths.assign(coarser.columns * coarser.rows, std::numeric_limits<real>::lowest());
+            for (size_t y = 0; y < rows; ++y) {
+                for (size_t x = 0; x < columns; ++x) {
+                    real& depth = coarser.depths[x / 2 + y / 2 * coarser.columns];
+                    depth = std::max(depth, finer.depths[x + y * columns]);
+                }
+            }
+            columns = coarser.columns;
+            rows = coarser.rows;
+            _levels.push_back(std::move(coarser));
+        }
+    }
+
+    // Whether every pixel of the rectangle [x0, x1] x [y0, y1] holds a point
+    // closer than `z`.
+    bool occludes(size_t x0, size_t y0, size_t x1, size_t y1, real z) const {
+        return occludes(_levels.size() - 1, 0, 0, {x0, y0, x1, y1}, z);
+    }
+
+private:
+    // Blocks of the first level are 2^first_shift pixels large.
+    static constexpr size_t first_shift = 2;
+
+    struct level {
+        // Blocks are 2^shift pixels large.
+        size_t shift;
+        size_t columns;
+        size_t rows;
+
+        // Largest depth in every block, row by row.
+        std::vector<real> depths;
+    };
+
+    // Tests the part of the rectangle `rect` (x0, y0, x1, y1) that falls into
+    // block (x, y) of level `level`, going down to the finer levels until
+    // the blocks are closer than `z` or can't be split any further.
+    bool occludes(size_t level, size_t x, size_t y, const std::array<size_t, 4>& rect, real z) const {
+        const auto& blocks = _levels[level];
+        if (blocks.depths[x + y * blocks.columns] < z) {
+            return true;
+        }
+        if (level == 0) {
+            return false;
+        }
+
+        const auto& finer = _levels[level - 1];
+        size_t shift = finer.shift;
+        for (size_t child_y = 2 * y; child_y < std::min(2 * y + 2, finer.rows); ++child_y) {
+            if ((child_y + 1) << shift <= rect[1] || child_y << shift > rect[3]) {
+                continue;
+            }
+            for (size_t child_x = 2 * x; child_x < std::min(2 * x + 2, finer.columns); ++child_x) {
+                if ((child_x + 1) << shift <= rect[0] || child_x << shift > rect[2]) {
+                    continue;
+                }
+                if (!occludes(level - 1, child_x, child_y, rect, z)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Levels from the finest one.
+    std::vector<level> _levels;
+};
+
+// Map from points of a 2D integer lattice to indices, used by the adaptive
+// sampler (see `renderer::render_adaptive_rows`) to find the surface points
+// that were already evaluated.
+//
+// It is a hash table with open addressing (linear probing) in two flat arrays,
+// so inserting a point doesn't allocate, and clearing it keeps the memory for
+// the next use.
+class lattice_map {
+public:
+    // Returns the index of point (x, y). If the point is not in the map yet,
+    // it is inserted with index `index`, which is returned.
+    uint32_t insert(uint32_t x, uint32_t y, uint32_t index) {
+        if (2 * (_size + 1) > _keys.size()) {
+            grow();
+        }
+
+        uint64_t key = uint64_t{x} << 32 | y;
+        size_t mask = _keys.size() - 1;
+        for (size_t slot = hash(key) & mask;; slot = (slot + 1) & mask) {
+            if (_keys[slot] == key) {
+                return _indices[slot];
+            }
+            if (_keys[slot] == empty) {
+                _keys[slot] = key;
+                _indices[slot] = index;
+                ++_size;
+                return index;
+            }
+        }
+    }
+
+    // Removes all points.
+    void clear() {
+        if (_size > 0) {
+            std::fill(_keys.begin(), _keys.end(), empty);
+            _size = 0;
+        }
+    }
+
+private:
+    // No point has both coordinates equal to the largest `uint32_t`.
+    static constexpr uint64_t empty = std::numeric_limits<uint64_t>::max();
+
+    static size_t hash(uint64_t key) {
+        // Fibonacci hashing, the high bits are the best mixed.
+        return static_cast<size_t>((key * 0x9e3779b97f4a7c15) >> 32);
+    }
+
+    // Doubles the number of slots and inserts the points again.
+    void grow() {
+        std::vector<uint64_t> keys(std::max<size_t>(1024, 2 * _keys.size()), empty);
+        std::vector<uint32_t> indices(keys.size());
+        size_t mask = keys.size() - 1;
+        for (size_t i = 0; i < _keys.size(); ++i) {
+            if (_keys[i] == empty) {
+                continue;
+            }
+            size_t slot = hash(_keys[i]) & mask;
+            while (keys[slot] != empty) {
+                slot = (slot + 1) & mask;
+            }
+            keys[slot] = _keys[i];
+            indices[slot] = _indices[i];
+        }
+        _keys = std::move(keys);
+        _indices = std::move(indices);
+    }
+
+    std::vector<uint64_t> _keys;
+    std::vector<uint32_t> _indices;
+    size_t _size = 0;
+};
+
+// Points waiting to be drawn, sorted into square tiles of the screen by the
+// pixel they fall into.
+//
+// Drawing points straight into a framebuffer hits pixels all over it, which
+// at high resolutions misses the cache on almost every point. Points binned
+// first can be drawn one tile at a time, with the tile's pixels staying in
+// the cache (see `renderer::render_tiled`). Points keep the order in which
+// they were added within each tile.
+class tile_bins {
+public:
+    // Largest width and height of the images whose points can be binned
+    // (coordinates of the binned points are 16-bit).
+    static constexpr size_t max_size = std::numeric_limits<uint16_t>::max();
+
+    // A binned point: the pixel it falls into, its depth, and its normal.
+    struct record {
+        vec<3> normal;
+        real z;
+        uint16_t x;
+        uint16_t y;
+    };
+
+    // `tile_size` has to be a power of two.
+    tile_bins(size_t width, size_t height, size_t tile_size)
+    : _width(width),
+      _height(height),
+      _tile_shift(static_cast<size_t>(std::countr_zero(tile_size))),
+      _columns((width + tile_size - 1) / tile_size) {
+        _bins.resize(_columns * ((height + tile_size - 1) / tile_size));
+    }
+
+    size_t width() const {
+        return _width;
+    }
+
+    size_t height() const {
+        return _height;
+    }
+
+    size_t tiles() const {
+        return _bins.size();
+    }
+
+    // Adds a point that falls into pixel (x, y).
+    void add(size_t x, size_t y, real z, const vec<4>& normal) {
+        _bins[(x >> _tile_shift) + (y >> _tile_shift) * _columns].push_back({
+            {normal[0], normal[1], normal[2]},
+            z,
+            static_cast<uint16_t>(x),
+            static_cast<uint16_t>(y)
+        });
+    }
+
+    // Points of the tile number `tile` (counting row by row).
+    std::span<const record> tile(size_t tile) const {
+        return _bins[tile];
+    }
+
+    // Removes all points, keeping the memory allocated for the next ones.
+    void clear() {
+        for (auto& bin : _bins) {
+            bin.clear();
+        }
+    }
+
+private:
+    size_t _width;
+    size_t _height;
+    size_t _tile_shift;
+    size_t _columns;
+    std::vector<std::vector<record>> _bins;
+};
+
+// Target that `renderer::render_single_sample` adds points to instead of
+// drawing them, while rendering in tiles. Points already hidden by the ones
+// drawn to `frame` are dropped right away: depths in the framebuffer can only
+// decrease, so they would be rejected later anyway.
+template <typename Framebuffer>
+struct binning_target {
+    size_t width() const {
+        return frame.width();
+    }
+
+    size_t height() const {
+        return frame.height();
+    }
+
+    bool occluded(size_t x, size_t y, real z) {
+        return frame.occluded(x, y, z);
+    }
+
+    Framebuffer& frame;
+    tile_bins& bins;
+};
+
+// Target that `renderer::render_single_sample` draws points of a known
+// order to, such that the result doesn't depend on the order in which they
+// are drawn.
+//
+// Normally, of the points with the smallest depth at a pixel, the last one
+// drawn wins. Here the point with the highest `index` wins instead, so
+// drawing points in any order gives the same frame as drawing them by
+// increasing index. Indices of the winning points are kept in `indices`.
+template <typename Framebuffer>
+struct ordered_target {
+    size_t width() const {
+        return frame.width();
+    }
+
+    size_t height() const {
+        return frame.height();
+    }
+
+    bool occluded(size_t x, size_t y, real z) {
+        return frame.occluded(x, y, z)
+            || (frame.same_depth(x, y, z) && indices[x + y * width()] > index);
+    }
+
+    void store_color(size_t x, size_t y, real z, const vec<3>& color) {
+        frame.store_color(x, y, z, color);
+        indices[x + y * width()] = index;
+    }
+
+    void store_normal(size_t x, size_t y, real z, const vec<3>& normal) {
+        frame.store_normal(x, y, z, normal);
+        indices[x + y * width()] = index;
+    }
+
+    Framebuffer& frame;
+    std::vector<size_t>& indices;
+
+    // Index of the point being drawn.
+    size_t index = 0;
+};
+
+// Target that `renderer::render_single_sample` draws points of a whole image
+// to, when only a horizontal band of it is kept in `target`: rows
+// [first_row, first_row + target.height()) of the `image_height` rows. Points
+// are clipped to the image, and the ones outside of the band are treated as
+// hidden.
+template <typename Target>
+struct band_target {
+    size_t width() const {
+        return target.width();
+    }
+
+    size_t height() const {
+        return image_height;
+    }
+
+    bool occluded(size_t x, size_t y, real z) {
+        return y < first_row || y - first_row >= target.height() || target.occluded(x, y - first_row, z);
+    }
+
+    void store_color(size_t x, size_t y, real z, const vec<3>& color) {
+        target.store_color(x, y - first_row, z, color);
+    }
+
+    void store_normal(size_t x, size_t y, real z, const vec<3>& normal) {
+        target.store_normal(x, y - first_row, z, normal);
+    }
+
+    Target& target;
+    size_t first_row;
+    size_t image_height;
+};
+
+template <typename T>
+inline constexpr bool is_binning_target = false;
+
+template <typename Framebuffer>
+inline constexpr bool is_binning_target<binning_target<Framebuffer>> = true;
+
+// Formats that frames can be encoded with.
+enum class output_format {
+    // Plain (ASCII) PPM. Human readable, handy for debugging, but three times
+    // larger and a lot slower to produce and parse.
+    // https://en.wikipedia.org/wiki/Netpbm#File_formats
+    p3,
+    // Raw (binary) PPM. One byte per color channel.
+    p6,
+    // YUV4MPEG2 video stream (https://wiki.multimedia.cx/index.php/YUV4MPEG2),
+    // which video encoders such as ffmpeg take in directly. Colors are
+    // converted to Y'CbCr and the chroma planes are stored at half (4:2:0) or
+    // full (4:4:4) resolution.
+    y4m_420,
+    y4m_444,
+};
+
+// Encodes images in an output format. It only encodes: frames are written
+// out by the caller (see `output_stream` and `frame_output`).
+//
+// The encoded frame is assembled in a buffer that is reused between frames,
+// so that the whole frame can be handed over to the kernel with a single
+// `write` call (instead of going through `std::cout` value by value).
+class frame_writer {
+public:
+    explicit frame_writer(output_format format) : _format(format) {}
+
+    // Header written once before all frames of a stream of `width` x
+    // `height` images played at `fps` frames per second. Only video formats
+    // have one.
+    std::string stream_header(size_t width, size_t height, size_t fps) const {
+        if (_format != output_format::y4m_420 && _format != output_format::y4m_444) {
+            return "";
+        }
+
+        // Frames are progressive with square pixels. `C420jpeg` places
+        // chroma samples in the middle of each 2x2 block of pixels, which is
+        // where `encode_y4m` takes them from.
+        return "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height)
+            + " F" + std::to_string(fps) + ":1 Ip A1:1"
+            + (_format == output_format::y4m_420 ? " C420jpeg" : " C444")
+            + "\n";
+    }
+
+    // Encodes the image into the internal buffer and returns it. The returned
+    // span is valid until the next call to `encode`.
+    template <typename Frame>
+    std::span<const unsigned char> encode(const Frame& frame) {
+        return encode(frame.width(), frame.height(), colors(frame));
+    }
+
+    // Encodes rows [first_row, first_row + frame.height()) of an image with
+    // `height` rows, held in `frame`, like `encode`. The band is cut off at
+    // the bottom of the image, and the one starting with its first row
+    // begins with the header, so encoded bands written out one after another
+    // make up the whole image. Only PPM formats can be encoded in bands.
+    template <typename Frame>
+    std::span<const unsigned char> encode_band(const Frame& frame, size_t first_row, size_t height) {
+        size_t rows = std::min(frame.height(), height - first_row);
+        if (_format == output_format::p3) {
+            encode_p3(frame.width(), height, colors(frame), first_row, rows);
+        } else {
+            encode_p6(frame.width(), height, colors(frame), first_row, rows);
+        }
+        return _buffer;
+    }
+
+private:
+    // Returns a function giving the 8-bit color of pixel `i` (counting row by
+    // row) of the frame.
+    static auto colors(const image& img) {
+        return [pixels = img.pixels()](size_t i) {
+            return std::array{quantize(pixels[i][0]), quantize(pixels[i][1]), quantize(pixels[i][2])};
+        };
+    }
+
+    static auto colors(const split_framebuffer& frame) {
+        return colors(frame.img);
+    }
+
+    // Packed framebuffers hold already quantized colors, which are copied
+    // as they are.
+    static auto colors(const packed_framebuffer& frame) {
+        return [&frame](size_t i) {
+            return frame.color(i);
+        };
+    }
+
+    // Encodes a `width` x `height` image whose pixel `i` (counting row by
+    // row) has the 8-bit color `colors(i)`.
+    template <typename Colors>
+    std::span<const unsigned char> encode(size_t width, size_t height, const Colors& colors) {
+        switch (_format) {
+        case output_format::p3:
+            encode_p3(width, height, colors, 0, height);
+            break;
+        case output_format::p6:
+            encode_p6(width, height, colors, 0, height);
+            break;
+        case output_format::y4m_420:
+        case output_format::y4m_444:
+            encode_y4m(width, height, colors);
+            break;
+        }
+
+        return _buffer;
+    }
+
+    // Starts the buffer with a PPM header of a `width` x `height` image if
+    // `first_row` is its first row, and empties it otherwise.
+    void ppm_header(size_t width, size_t height, size_t first_row, const char* magic) {
+        _buffer.clear();
+        if (first_row > 0) {
+            return;
+        }
+        std::string header = magic + ("\n" + std::to_string(width) + " "
+            + std::to_string(height) + "\n255\n");
+        _buffer.assign(header.begin(), header.end());
+    }
+
+    // PPM encoders write `rows` rows of a `width` x `height` image, starting
+    // with row `first_row` (see `encode_band`). Pixel `i` of `colors` is the
+    // `i`-th pixel of these rows.
+    template <typename Colors>
+    void encode_p3(size_t width, size_t height, const Colors& colors, size_t first_row, size_t rows) {
+        ppm_header(width, height, first_row, "P3");
+        for (size_t i = 0; i < width * rows; ++i) {
+            auto color = colors(i);
+            append(_buffer, color[0]);
+            _buffer.push_back(' ');
+            append(_buffer, color[1]);
+            _buffer.push_back(' ');
+            append(_buffer, color[2]);
+            _buffer.push_back('\n');
+        }
+    }
+
+    template <typename Colors>
+    void encode_p6(size_t width, size_t height, const Colors& colors, size_t first_row, size_t rows) {
+        ppm_header(width, height, first_row, "P6");
+        size_t header_size = _buffer.size();
+        _buffer.resize(header_size + width * rows * 3);
+
+        unsigned char* out = _buffer.data() + header_size;
+        for (size_t i = 0; i < width * rows; ++i) {
+            auto color = colors(i);
+            out[3 * i + 0] = color[0];
+            out[3 * i + 1] = color[1];
+            out[3 * i + 2] = color[2];
+        }
+    }
+
+    // Encodes a YUV4MPEG2 frame: a `FRAME` line followed by the Y', Cb and Cr
+    // planes.
+    //
+    // Colors are the same as in PPM and are converted with the
+    // 8-bit integer approximation of the BT.601 limited range matrix (see
+    // https://en.wikipedia.org/wiki/YCbCr#ITU-R_BT.601_conversion). Channels
+    // are first split into separate planes, so that the conversion loops
+    // only do the same arithmetic on consecutive bytes and can be vectorized
+    // by the compiler.
+    template <typename Colors>
+    void encode_y4m(size_t width, size_t height, const Colors& colors) {
+        const std::string_view frame_header = "FRAME\n";
+        bool subsampled = _format == output_format::y4m_420;
+        size_t chroma_width = subsampled ? (width + 1) / 2 : width;
+        size_t chroma_height = subsampled ? (height + 1) / 2 : height;
+        size_t luma_size = width * height;
+        size_t chroma_size = chroma_width * chroma_height;
+
+        for (auto& plane : _planes) {
+            plane.resize(luma_size);
+        }
+        // Stores through `unsigned char` pointers may alias anything, so the
+        // loops work on plain pointers instead of indexing the vectors (which
+        // would reload their data pointers after every store).
+        unsigned char* r = _planes[0].data();
+        unsigned char* g = _planes[1].data();
+        unsigned char* b = _planes[2].data();
+        for (size_t i = 0; i < luma_size; ++i) {
+            auto color = colors(i);
+            r[i] = color[0];
+            g[i] = color[1];
+            b[i] = color[2];
+        }
+
+        _buffer.assign(frame_header.begin(), frame_header.end());
+        size_t header_size = _buffer.size();
+        _buffer.resize(header_size + luma_size + 2 * chroma_size);
+        unsigned char* luma = _buffer.data() + header_size;
+        unsigned char* cb = luma + luma_size;
+        unsigned char* cr = cb + chroma_size;
+
+        for (size_t i = 0; i < luma_size; ++i) {
+            luma[i] = static_cast<unsigned char>(((66 * r[i] + 129 * g[i] + 25 * b[i] + 128) >> 8) + 16);
+        }
+
+        if (!subsampled) {
+            for (size_t i = 0; i < luma_size; ++i) {
+                cb[i] = static_cast<unsigned char>(((-38 * r[i] - 74 * g[i] + 112 * b[i] + 128) >> 8) + 128);
+                cr[i] = static_cast<unsigned char>(((112 * r[i] - 94 * g[i] - 18 * b[i] + 128) >> 8) + 128);
+            }
+            return;
+        }
+
+        // The conversion is linear, so the chroma of a 2x2 block is computed
+        // from the sums of its colors. Blocks on the right and bottom edges of
+        // images with odd sizes repeat the last column or row.
+        std::array<std::vector<int>, 3> sums;
+        for (auto& sum : sums) {
+            sum.resize(chroma_width);
+        }
+        for (size_t y = 0; y < chroma_height; ++y) {
+            size_t top = 2 * y * width;
+            size_t bottom = std::min(2 * y + 1, height - 1) * width;
+            for (size_t c = 0; c < 3; ++c) {
+                const unsigned char* plane = _planes[c].data();
+                for (size_t x = 0; x < chroma_width; ++x) {
+                    size_t left = 2 * x;
+                    size_t right = std::min(2 * x + 1, width - 1);
+                    sums[c][x] = plane[top + left] + plane[top + right]
+                        + plane[bottom + left] + plane[bottom + right];
+                }
+            }
+
+            const int* rs = sums[0].data();
+            const int* gs = sums[1].data();
+            const int* bs = sums[2].data();
+            unsigned char* cb_row = cb + y * chroma_width;
+            unsigned char* cr_row = cr + y * chroma_width;
+            for (size_t x = 0; x < chroma_width; ++x) {
+                cb_row[x] = static_cast<unsigned char>(((-38 * rs[x] - 74 * gs[x] + 112 * bs[x] + 512) >> 10) + 128);
+                cr_row[x] = static_cast<unsigned char>(((112 * rs[x] - 94 * gs[x] - 18 * bs[x] + 512) >> 10) + 128);
+            }
+        }
+    }
+
+    // Appends decimal representation of a color channel value to the buffer.
+    static void append(std::vector<unsigned char>& buffer, unsigned char value) {
+        char digits[3];
+        auto [end, ec] = std::to_chars(std::begin(digits), std::end(digits), value);
+        buffer.insert(buffer.end(), digits, end);
+    }
+
+    output_format _format;
+    std::vector<unsigned char> _buffer;
+
+    // Red, green and blue channels of the image being encoded, used by
+    // `encode_y4m`.
+    std::array<std::vector<unsigned char>, 3> _planes;
+};
+
+namespace ffi {
+    extern "C" {
+        #include "surface.h"
+        #include "surface_batch.h"
+        #include "surface_grid.h"
+    }
+
+    // Overloads resolving to the `float` variants of the generated functions.
+    inline void surface(float u, float v, float* out) {
+        surfacef(u, v, out);
+    }
+
+    inline void normal(float u, float v, float* out) {
+        normalf(u, v, out);
+    }
+
+    inline void surface_batch(
+        size_t n, const float* us, const float* vs, float* out_x, float* out_y, float* out_z
+    ) {
+        surface_batchf(n, us, vs, out_x, out_y, out_z);
+    }
+
+    inline void normal_batch(
+        size_t n, const float* us, const float* vs, float* out_x, float* out_y, float* out_z
+    ) {
+        normal_batchf(n, us, vs, out_x, out_y, out_z);
+    }
+
+    inline void grid_u_factors(size_t n, const float* us, float* factors, size_t stride) {
+        grid_u_factorsf(n, us, factors, stride);
+    }
+
+    inline void grid_v_factors(float v, float* factors) {
+        grid_v_factorsf(v, factors);
+    }
+
+    inline void grid_row(
+        size_t n, const float* u_factors, size_t stride, const float* v_factors,
+        float* out_x, float* out_y, float* out_z, float* out_normal_x, float* out_normal_y, float* out_normal_z
+    ) {
+        grid_rowf(n, u_factors, stride, v_factors, out_x, out_y, out_z, out_normal_x, out_normal_y, out_normal_z);
+    }
+}
+
+// `surface` class provides a way to sample points on a pre-defined 3D surface.
+//
+// The surface is defined by a parametric equation, in python module
+// `src/codegen/surface.py`. Thanks to `sympy`'s code generation abillities, the
+// equation can be translated to C code and used here (see the `ffi` namespace
+// and the `codegen` directory for more details) .
+//
+// The surface is defined in a coordinate system where the surface is centered
+// at the origin. The surface is then transformed to world coordinates by
+// applying a model transform and a world transform. The model transform is
+// applied first, and is used to scale and rotate the surface. The world
+// transform is applied second, and is used to position the surface in the
+// world.
+class surface {
+public:
+    // The convention kept throughout the code is that points and vectors are
+    // using homogeneous coordinates. A point is represented as a 4-dimensional
+    // vector, where the last coordinate is 1.0, and a vector is represented as
+    // a 4-dimensional vector, where the last coordinate is 0.0. This allows
+    // using the same transformation matrices for both points and vectors.
+    struct point {
+        vec<4> position = {0, 0, 0, 1};
+        vec<4> normal = {0, 0, 0, 0};
+    };
+
+    // Array of points stored as a structure of arrays: x, y, z coordinates of
+    // positions followed by x, y, z coordinates of normals (the homogeneous
+    // coordinates are implied). Coordinates are stored in the precision of the
+    // surface equations.
+    struct point_array {
+        std::array<std::vector<real>, 6> coordinates;
+
+        void resize(size_t size) {
+            for (auto& coordinate : coordinates) {
+                coordinate.resize(size);
+            }
+        }
+
+        size_t size() const {
+            return coordinates[0].size();
+        }
+
+        point operator[](size_t i) const {
+            point p;
+            for (size_t c = 0; c < 3; ++c) {
+                p.position[c] = coordinates[c][i];
+                p.normal[c] = coordinates[3 + c][i];
+            }
+            return p;
+        }
+    };
+
+    // Samples point on the surface in world coordinates.
+    // Input vector `uv`
+    // (which contains parameters for the surface equation) should be in the
+    // range [0, 1] x [0, 1].
+    // Returns a point on the surface in world coordinates together with the
+    // normal vector at that point.
+    point sample(vec<2> uv) const {
+        return to_world(sample_model(uv));
+    }
+
+    // Samples point on the surface in the surface's own coordinate system
+    // (before applying the model and world transforms). The result does not
+    // depend on the world transform, so it can be reused between frames.
+    point sample_model(vec<2> uv) const {
+        uv = to_sample_space * uv;
+        auto u = static_cast<real>(uv[0]);
+        auto v = static_cast<real>(uv[1]);
+
+        std::array<real, 3> position, normal;
+        ffi::surface(u, v, position.data());
+        ffi::normal(u, v, normal.data());
+
+        point result;
+        std::copy(position.begin(), position.end(), result.position.begin());
+        std::copy(normal.begin(), normal.end(), result.normal.begin());
+        return result;
+    }
+
+    // Batch version of `sample_model`. Samples the surface at all `uv`
+    // parameters and writes the points to `out`, starting at index `offset`.
+    //
+    // The surface equations are evaluated by vectorized kernels (see
+    // `surface_batch.h`), which are several times faster than sampling points
+    // one by one, but may differ from `sample_model` in the last bits.
+    void sample_model(std::span<const vec<2>> uv, point_array& out, size_t offset = 0) const {
+        // Parameters are converted to the sample space in chunks small enough
+        // to fit on the stack.
+        std::array<real, chunk> u, v;
+
+        for (size_t begin = 0; begin < uv.size(); begin += chunk) {
+            size_t n = std::min(chunk, uv.size() - begin);
+            to_sample_space_chunk(uv.subspan(begin, n), u, v);
+
+            auto out_at = [&](size_t coordinate) {
+                return out.coordinates[coordinate].data() + offset + begin;
+            };
+            ffi::surface_batch(n, u.data(), v.data(), out_at(0), out_at(1), out_at(2));
+            ffi::normal_batch(n, u.data(), v.data(), out_at(3), out_at(4), out_at(5));
+        }
+    }
+
+    // Batch version of `sample`: samples the surface at all `uv` parameters
+    // and writes the points, in world coordinates, to `out`. Gives the same
+    // points as `sample_model` followed by `to_world`.
+    void sample_batch(std::span<const vec<2>> uv, point_array& out) const {
+        out.resize(uv.size());
+
+        // Points in the surface's coordinate system only live on the stack,
+        // one chunk at a time.
+        std::array<real, chunk> u, v;
+        std::array<std::array<real, chunk>, 6> model;
+
+        for (size_t begin = 0; begin < uv.size(); begin += chunk) {
+            size_t n = std::min(chunk, uv.size() - begin);
+            to_sample_space_chunk(uv.subspan(begin, n), u, v);
+
+            ffi::surface_batch(n, u.data(), v.data(), model[0].data(), model[1].data(), model[2].data());
+            ffi::normal_batch(n, u.data(), v.data(), model[3].data(), model[4].data(), model[5].data());
+
+            auto in_at = [&](size_t coordinate) -> const real* {
+                return model[coordinate].data();
+            };
+            auto out_at = [&](size_t coordinate) {
+                return out.coordinates[coordinate].data() + begin;
+            };
+            transform(_position_transform, 1, {in_at(0), in_at(1), in_at(2)}, {out_at(0), out_at(1), out_at(2)}, n);
+            transform(_normal_transform, 0, {in_at(3), in_at(4), in_at(5)}, {out_at(3), out_at(4), out_at(5)}, n);
+        }
+    }
+
+    // Columns of a regular grid of parameters, with the parts of the surface
+    // equations that depend only on their `u` parameters (see `grid_row` in
+    // `surface_grid.h`). Samples in a row of the grid differ only in these,
+    // so the rows are sampled without evaluating any trigonometric functions.
+    struct grid_columns {
+        // `GRID_U_FACTORS` arrays of `size` factors, one after another.
+        std::vector<real> factors;
+        size_t size = 0;
+
+        // Replaces the columns with columns `indices` of `other`.
+        void select(const grid_columns& other, std::span<const size_t> indices) {
+            size = indices.size();
+            factors.resize(GRID_U_FACTORS * size);
+            for (size_t k = 0; k < GRID_U_FACTORS; ++k) {
+                const real* from = other.factors.data() + k * other.size;
+                real* to = factors.data() + k * size;
+                for (size_t i = 0; i < size; ++i) {
+                    to[i] = from[indices[i]];
+                }
+            }
+        }
+    };
+
+    // Creates the columns of a grid with parameters `u` (in the range [0, 1]).
+    grid_columns sample_columns(std::span<const real> u) const {
+        std::vector<real> sample_u(u.size());
+        for (size_t i = 0; i < u.size(); ++i) {
+            sample_u[i] = static_cast<real>((to_sample_space * vec<2>{u[i], 0})[0]);
+        }
+
+        grid_columns columns;
+        columns.size = u.size();
+        columns.factors.resize(GRID_U_FACTORS * u.size());
+        ffi::grid_u_factors(u.size(), sample_u.data(), columns.factors.data(), u.size());
+        return columns;
+    }
+
+    // Samples the surface at all `columns` of the grid row with parameter `v`
+    // (in the range [0, 1]) and writes the points, in the surface's own
+    // coordinate system, to `out`, starting at index `offset`.
+    //
+    // Evaluating separated equations gives slightly different results than
+    // the other sampling functions, so a grid has to be sampled only with
+    // these.
+    void sample_model_row(const grid_columns& columns, real v, point_array& out, size_t offset = 0) const {
+        auto v_factors = row_factors(v);
+        auto out_at = [&](size_t coordinate) {
+            return out.coordinates[coordinate].data() + offset;
+        };
+        ffi::grid_row(
+            columns.size, columns.factors.data(), columns.size, v_factors.data(),
+            out_at(0), out_at(1), out_at(2), out_at(3), out_at(4), out_at(5)
+        );
+    }
+
+    // Version of `sample_model_row` writing the points in world coordinates.
+    // Only columns [first, first + count) are sampled (as many as there are,
+    // by default all of them), and written to `out` from index 0.
+    void sample_row(
+        const grid_columns& columns,
+        real v,
+        point_array& out,
+        size_t first = 0,
+        size_t count = std::numeric_limits<size_t>::max()
+    ) const {
+        count = std::min(count, columns.size - first);
+        out.resize(count);
+        auto v_factors = row_factors(v);
+
+        // Points in the surface's coordinate system only live on the stack,
+        // one chunk at a time.
+        std::array<std::array<real, chunk>, 6> model;
+
+        for (size_t begin = 0; begin < count; begin += chunk) {
+            size_t n = std::min(chunk, count - begin);
+            ffi::grid_row(
+                n, columns.factors.data() + first + begin, columns.size, v_factors.data(),
+                model[0].data(), model[1].data(), model[2].data(),
+                model[3].data(), model[4].data(), model[5].data()
+            );
+
+            auto in_at = [&](size_t coordinate) -> const real* {
+                return model[coordinate].data();
+            };
+            auto out_at = [&](size_t coordinate) {
+                return out.coordinates[coordinate].data() + begin;
+            };
+            transform(_position_transform, 1, {in_at(0), in_at(1), in_at(2)}, {out_at(0), out_at(1), out_at(2)}, n);
+            transform(_normal_transform, 0, {in_at(3), in_at(4), in_at(5)}, {out_at(3), out_at(4), out_at(5)}, n);
+        }
+    }
+
+    // Maps a point returned by `sample_model` to world coordinates.
+    point to_world(point p) const {
+        p.position = _position_transform * p.position;
+        p.normal = _normal_transform * p.normal;
+        return p;
+    }
+
+    // Maps `count` points of `in` (returned by `sample_model`), starting at
+    // index `offset`, to world coordinates and writes them to `out`, which
+    // must be a different array.
+    void to_world(const point_array& in, size_t offset, size_t count, point_array& out) const {
+        out.resize(count);
+        auto in_at = [&](size_t coordinate) {
+            return in.coordinates[coordinate].data() + offset;
+        };
+        auto out_at = [&](size_t coordinate) {
+            return out.coordinates[coordinate].data();
+        };
+        transform(_position_transform, 1, {in_at(0), in_at(1), in_at(2)}, {out_at(0), out_at(1), out_at(2)}, count);
+        transform(_normal_transform, 0, {in_at(3), in_at(4), in_at(5)}, {out_at(3), out_at(4), out_at(5)}, count);
+    }
+
+    // Sets the world transform for the surface.
+    //
+    // The world transform is used to position the surface in the world - it
+    // maps the surface's local coordinate system to the world coordinate
+    // system.
+    //
+    // The transform is split into two parts. The first one contains all
+    // world-space transformations, such as translation, rotation, and scaling.
+    // The second one should contain only transformations that can be
+    // applied to normals (such as rotation).
+    //
+    // The world transforms are composed with the model transforms here, once,
+    // and not for every transformed point.
+    void set_transform(mat<4, 4> transform, mat<4, 4> normal) {
+        _position_transform = transform * _model_transform;
+        _normal_transform = normal * _model_normal;
+    }
+
+private:
+    // Number of points sampled at once by the batch functions, small enough
+    // for their temporary arrays to fit on the stack.
+    static constexpr size_t chunk = 256;
+
+    // Parts of the surface equations that depend only on the `v` parameter
+    // (in the range [0, 1]) of a grid row.
+    std::array<real, GRID_V_FACTORS> row_factors(real v) const {
+        std::array<real, GRID_V_FACTORS> factors;
+        ffi::grid_v_factors(static_cast<real>((to_sample_space * vec<2>{0, v})[1]), factors.data());
+        return factors;
+    }
+
+    // Converts parameters `uv` (at most `chunk` of them) to the sample space.
+    void to_sample_space_chunk(
+        std::span<const vec<2>> uv,
+        std::array<real, chunk>& u,
+        std::array<real, chunk>& v
+    ) const {
+        for (size_t i = 0; i < uv.size(); ++i) {
+            auto parameters = to_sample_space * uv[i];
+            u[i] = static_cast<real>(parameters[0]);
+            v[i] = static_cast<real>(parameters[1]);
+        }
+    }
+
+    // Multiplies `count` vectors, whose x, y, z coordinates are stored in
+    // separate arrays `in` and whose homogeneous coordinate is `w`, by the
+    // matrix `m`, and writes x, y, z coordinates of the results to `out`.
+    //
+    // The sums are computed in the same order as in `operator*` of `mat` and
+    // `vec`, so the results are exactly the same as transforming the points
+    // one by one. The homogeneous coordinate of the result is not stored: the
+    // transforms are affine, so it is `w` again.
+    static void transform(
+        const mat<4, 4>& m,
+        real w,
+        std::array<const real*, 3> in,
+        std::array<real*, 3> out,
+        size_t count
+    ) {
+        for (size_t row = 0; row < 3; ++row) {
+            std::array<real, 4> r = m[row];
+            const real* x = in[0];
+            const real* y = in[1];
+            const real* z = in[2];
+            real* result = out[row];
+            for (size_t i = 0; i < count; ++i) {
+                result[i] = real(0) + r[0] * x[i] + r[1] * y[i] + r[2] * z[i] + r[3] * w;
+            }
+        }
+    }
+
+    // Model transform is used to scale the surface to a reasonable size and
+    // rotate it so that its larger dimensions are along x y axes.
+    //
+    // Similarly to the world transform, the model transform is split into two
+    // parts.
+    const mat<4, 4> _model_normal = rotate_along_x(static_cast<real>(-pi / 2));
+    const mat<4, 4> _model_transform = scale(static_cast<real>(1.0 / 20)) * _model_normal;
+
+    // The equation for the surface should be sampled in range [0, 2pi] x [0,
+    // pi]. This matrix is used to transform the input vector to that range.
+    const mat<2,2> to_sample_space = {{
+        {real(2.0 * std::numbers::pi), 0},
+        {0, real(std::numbers::pi)}
+    }};
+
+    // World transforms composed with the model transforms (see
+    // `set_transform`).
+    mat<4, 4> _position_transform = _model_transform;
+    mat<4, 4> _normal_transform = _model_normal;
+};
+
+// Stores surface points sampled on a regular grid of `uv` parameters.
+//
+// Points are stored in the surface's own coordinate system (see
+// `surface::sample_model`), which doesn't change between frames. Renderer uses
+// the same sample grid for every frame, so the expensive surface equations
+// can be evaluated once and only the world transform has to be applied for
+// each frame.
+//
+// The cache is given a memory budget. If the whole grid doesn't fit in it,
+// only the first rows of the grid are stored (and the rest has to be sampled
+// every frame).
+//
+// Coordinates are stored as a structure of arrays (see `surface::point_array`),
+// which keeps the memory dense (no homogeneous coordinates are stored) and lets
+// the cache be filled by the vectorized surface kernels.
+class sample_cache {
+public:
+    // Size of a single cached sample in bytes.
+    static constexpr size_t sample_size = 6 * sizeof(real);
+
+    // Creates an empty cache for a grid of `columns` x `rows` samples, which
+    // can use up to `budget` bytes of memory.
+    sample_cache(size_t columns, size_t rows, size_t budget)
+    : _columns(columns) {
+        _rows = columns == 0 ? 0 : std::min(rows, budget / sample_size / columns);
+        _points.resize(_columns * _rows);
+    }
+
+    // Number of the first grid rows held by the cache.
+    size_t rows() const {
+        return _rows;
+    }
+
+    // Number of bytes used by the cached samples.
+    size_t memory_usage() const {
+        return _columns * _rows * sample_size;
+    }
+
+    // Cached points, row by row.
+    surface::point_array& points() {
+        return _points;
+    }
+
+    const surface::point_array& points() const {
+        return _points;
+    }
+
+private:
+    size_t _columns;
+    size_t _rows;
+    surface::point_array _points;
+};
+
+// Stores encoded frames, so that frames which look the same don't have to be
+// rendered again.
+//
+// Frames are identified by a key describing everything they depend on (see
+// `renderer::frame_key`). The cache has two tiers: frames are kept in memory,
+// up to a memory budget, and optionally in a directory, where they survive
+// between runs. Files in the directory are named after a hash of the key and
+// start with the key itself, so that a hash collision can't return a wrong
+// frame.
+//
+// The cache can be used by multiple threads at once.
+class frame_cache {
+public:
+    using frame = std::shared_ptr<const std::vector<unsigned char>>;
+
+    // Creates a cache that keeps up to `budget` bytes of frames in memory,
+    // and stores them in `directory` too, unless it is empty.
+    frame_cache(size_t budget, std::filesystem::path directory)
+    : _budget(budget), _directory(std::move(directory)) {
+        if (!_directory.empty()) {
+            std::filesystem::create_directories(_directory);
+        }
+    }
+
+    // Whether frames can be stored at all.
+    bool enabled() const {
+        return _budget > 0 || !_directory.empty();
+    }
+
+    // Whether frames are stored in a directory, where later runs find them.
+    bool persistent() const {
+        return !_directory.empty();
+    }
+
+    // Returns the frame stored under `key`, or null if there is none.
+    frame find(const std::string& key) {
+        {
+            std::lock_guard lock(_mutex);
+            if (auto found = _frames.find(key); found != _frames.end()) {
+                ++_hits;
+                return found->second;
+            }
+        }
+
+        frame result = load(key);
+
+        std::lock_guard lock(_mutex);
+        if (result) {
+            ++_hits;
+            ++_disk_hits;
+            store(key, result);
+        } else {
+            ++_misses;
+        }
+        return result;
+    }
+
+    // Stores `data` as the frame with the given `key`.
+    void insert(const std::string& key, std::span<const unsigned char> data) {
+        if (!enabled()) {
+            return;
+        }
+
+        auto result = std::make_shared<const std::vector<unsigned char>>(data.begin(), data.end());
+        {
+            std::lock_guard lock(_mutex);
+            store(key, result);
+        }
+        save(key, *result);
+    }
+
+    size_t hits() const {
+        return _hits;
+    }
+
+    // Number of hits that were read from the directory.
+    size_t disk_hits() const {
+        return _disk_hits;
+    }
+
+    size_t misses() const {
+        return _misses;
+    }
+
+private:
+    // Keeps the frame in memory if it fits in the budget. Has to be called
+    // with `_mutex` locked.
+    void store(const std::string& key, const frame& data) {
+        if (_memory_usage + data->size() > _budget || _frames.contains(key)) {
+            return;
+        }
+        _memory_usage += data->size();
+        _frames.emplace(key, data);
+    }
+
+    // Path of the file holding the frame with the given `key`.
+    std::filesystem::path file(const std::string& key) const {
+        // 64-bit FNV-1a hash, see
+        // https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+        uint64_t hash = 0xcbf29ce484222325;
+        for (char c : key) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+        }
+
+        char name[16];
+        auto [end, ec] = std::to_chars(std::begin(name), std::end(name), hash, 16);
+        return _directory / (std::string(16 - (end - name), '0') + std::string(name, end) + ".frame");
+    }
+
+    // Reads the frame with the given `key` from the directory.
+    frame load(const std::string& key) const {
+        if (_directory.empty()) {
+            return nullptr;
+        }
+
+        std::ifstream in(file(key), std::ios::binary);
+        std::string contents(std::istreambuf_iterator<char>(in), {});
+        if (!contents.starts_with(key + '\n')) {
+            return nullptr;
+        }
+        return std::make_shared<const std::vector<unsigned char>>(
+            contents.begin() + static_cast<long>(key.size() + 1), contents.end()
+        );
+    }
+
+    // Writes the frame to the directory. The file is written under a
+    // temporary name first, so that other processes never read a partially
+    // written frame. Failures are ignored, as the frame is just not cached.
+    void save(const std::string& key, const std::vector<unsigned char>& data) const {
+        if (_directory.empty()) {
+            return;
+        }
+
+        auto path = file(key);
+        auto temporary = path;
+        temporary += ".tmp" + std::to_string(getpid()) + "-"
+            + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            std::ofstream out(temporary, std::ios::binary);
+            out << key << '\n';
+            out.write(reinterpret_cast<const char*>(data.data()), static_cast<long>(data.size()));
+            if (!out) {
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temporary, path, error);
+        if (error) {
+            std::filesystem::remove(temporary, error);
+        }
+    }
+
+    size_t _budget;
+    std::filesystem::path _directory;
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, frame> _frames;
+    size_t _memory_usage = 0;
+
+    std::atomic<size_t> _hits = 0;
+    std::atomic<size_t> _disk_hits = 0;
+    std::atomic<size_t> _misses = 0;
+};
+
+// How the surface is turned into pixels.
+enum class render_mode {
+    // Every sample of the surface is drawn as a single pixel.
+    points,
+    // The surface is tessellated into a triangle mesh, which is rasterized.
+    raster,
+    // Like `points`, but the samples are placed adaptively, so that
+    // neighbouring samples are about `1 / quality` pixels apart on the image.
+    adaptive,
+};
+
+// When the lighting of the surface is computed.
+enum class shading_mode {
+    // Every sample that passes the depth test is shaded right away.
+    forward,
+    // Only normals are stored while rendering, and every visible pixel is
+    // shaded once at the end (see `renderer::shade_rows`).
+    deferred,
+};
+
+// How depths and colors of the pixels being rendered are stored.
+enum class framebuffer_layout {
+    // Full precision colors and depths in separate buffers (see
+    // `split_framebuffer`).
+    split,
+    // Depth and 8-bit color of a pixel packed into a single word (see
+    // `packed_framebuffer`). Takes less memory and is faster to update, but
+    // the images may differ slightly from the `split` ones.
+    packed,
+};
+
+// Parameters of a rendering job.
+struct render_settings {
+    // Size of the output images in pixels.
+    size_t width = 256;
+    size_t height = 256;
+
+    // Number of frames per second and length of the animation in seconds.
+    size_t fps = 60;
+    size_t length = 4;
+
+    // Range of frames that are rendered: `frame_count` frames (or as many as
+    // the animation has left) starting with frame number `frame_start`.
+    // Frames depend only on their number, so an animation can be rendered in
+    // parts (e.g. on different machines), and the outputs of consecutive
+    // parts joined together are the same as the output of the whole
+    // animation. For that, the stream header (see
+    // `frame_writer::stream_header`) is written only by the part starting
+    // with the first frame.
+    size_t frame_start = 0;
+    size_t frame_count = std::numeric_limits<size_t>::max();
+
+    // Square root of the number of samples taken per pixel. Used by the
+    // `points` and `adaptive` modes.
+    size_t quality = 3;
+
+    render_mode mode = render_mode::points;
+    shading_mode shading = shading_mode::deferred;
+
+    output_format format = output_format::p6;
+    framebuffer_layout framebuffer = framebuffer_layout::split;
+
+    // Number of threads rendering each frame.
+    size_t threads = 1;
+
+    // Number of frames rendered at the same time. Each of these frames is
+    // rendered by a single thread.
+    size_t frame_threads = 1;
+
+    // Maximum number of frames that are being rendered or waiting to be written
+    // at once. Bounds the memory used by the frame-parallel pipeline. Zero
+    // means twice the number of `frame_threads`.
+    size_t frames_in_flight = 0;
+
+    // Number of passes frames are rendered in (see
+    // `renderer::render_progressive_frame`). Every pass but the last one
+    // writes a preview of the frame. 1 renders frames in a single pass. Only
+    // used by the `points` mode, with a single thread.
+    size_t progressive_passes = 1;
+
+    // Size (in pixels) of the screen tiles points are binned into before
+    // they are drawn (see `renderer::render_tiled`), a power of two. 0 draws
+    // points directly. Not used by the `raster` mode.
+    size_t tile_size = 0;
+
+    // Whether patches of the sample grid that are hidden in a frame are
+    // skipped as a whole (see `renderer::render_culled_rows`). Doesn't change
+    // the images. Only used by the `points` mode, without tiles and
+    // progressive passes.
+    bool culling = true;
+
+    // Number of image rows rendered at once (see `renderer::render_culled_rows`).
+    // Frames higher than that are rendered in horizontal bands, one after
+    // another, into framebuffers holding a single band, and every band is
+    // written out as soon as it is done. Images stay the same, while the
+    // framebuffers take memory proportional to the width of the images
+    // instead of their size. 0 renders whole frames. Only used by the
+    // `points` mode with PPM formats, a single frame thread, and without
+    // tiles and progressive passes. Frames rendered in bands are not cached.
+    size_t band_height = 0;
+
+    // Memory budget of the sample cache in bytes (see `sample_cache`).
+    size_t sample_cache_budget = 256 << 20;
+
+    // Memory budget of the frame cache in bytes, and the directory where it
+    // stores frames (none if empty). See `frame_cache`.
+    size_t frame_cache_budget = 256 << 20;
+    std::string frame_cache_directory;
+
+    // Whether the renderer is reused for more animations (by the render
+    // server, see `src/server.hh`), which can take frames cached by earlier
+    // ones. Otherwise, only frames that repeat later in the rendered range or
+    // are stored in `frame_cache_directory` are cached.
+    bool reused = false;
+
+    // Whether frames written to a pipe are handed over to it with `vmsplice`
+    // instead of being copied (see `frame_output`). Only safe if the reader
+    // copies the data out of the pipe: a reader that moves it on with
+    // `splice` or `tee` may see frames overwritten by later ones.
+    bool splice = false;
+
+    // Whether to collect and report statistics (see `render_stats`).
+    bool stats = false;
+};
+
+// Statistics of rendering, collected with `render_settings::stats` and
+// reported to stderr.
+struct render_stats {
+    // Time spent in the stages of rendering, in seconds. When rendering with
+    // multiple threads, the times of all threads are added up.
+    double evaluation = 0;
+    double projection = 0;
+    double shading = 0;
+    double encoding = 0;
+
+    // Time of whole frames (rendering and encoding), in seconds.
+    double total = 0;
+
+    // Number of rendered frames.
+    size_t frames = 0;
+
+    // Number of samples drawn (pixels filled, in the `raster` mode), and how
+    // many of them were outside of the image and behind other samples. Samples
+    // of culled patches count as drawn, and as `culled` instead. Frames
+    // rendered in bands count the samples drawn in every band, with the ones
+    // falling outside of the band as rejected.
+    size_t samples = 0;
+    size_t clipped = 0;
+    size_t rejected = 0;
+    size_t culled = 0;
+
+    // Number of pixels that any sample was drawn to.
+    size_t covered = 0;
+
+    render_stats& operator+=(const render_stats& other) {
+        evaluation += other.evaluation;
+        projection += other.projection;
+        shading += other.shading;
+        encoding += other.encoding;
+        total += other.total;
+        frames += other.frames;
+        samples += other.samples;
+        clipped += other.clipped;
+        rejected += other.rejected;
+        culled += other.culled;
+        covered += other.covered;
+        return *this;
+    }
+};
+
+// Adds the time elapsed between its construction and destruction to
+// `seconds`. Does nothing if `Enabled` is false, so that it can be left in
+// the code paths that run without collecting statistics.
+template <bool Enabled>
+class stage_timer {
+public:
+    explicit stage_timer(double& seconds) : _seconds(seconds) {
+        if constexpr (Enabled) {
+            _start = std::chrono::steady_clock::now();
+        }
+    }
+
+    stage_timer(const stage_timer&) = delete;
+    stage_timer& operator=(const stage_timer&) = delete;
+
+    ~stage_timer() {
+        if constexpr (Enabled) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - _start;
+            _seconds += elapsed.count();
+        }
+    }
+
+private:
+    double& _seconds;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// `renderer` class is used to generate series of images of a rotating surface.
+//
+// The renderer uses a `surface` object to sample points on the surface. It
+// applies lighting to the points using a simple Phong model. It then projects
+// the points onto a 2D plane using a perspective projection. Finally, it uses
+// a z-buffer to determine which points are visible and which are not.
+//
+// Output images are written to stdout (or another `output_stream`) as a
+// sequence of PPM images or as a YUV4MPEG2 video stream (see `frame_writer`).
+//
+// In the `raster` mode, the sample grid has one vertex per pixel instead of
+// `quality^2` samples, and neighbouring samples are connected into triangles
+// which are filled pixel by pixel (see `rasterize_rows`). Depth and normals are
+// interpolated across the triangles, so the image has no holes even where the
+// surface is stretched, while the surface is evaluated far less often.
+//
+// In the `adaptive` mode, the samples are not taken on a fixed grid. Instead,
+// cells of the parameter domain are subdivided until their projection is small
+// enough (see `render_adaptive_rows`). The parameterization of the surface is
+// very uneven (whole rows of the grid collapse into a single point at the
+// poles), so this takes much fewer samples to cover the surface equally well.
+//
+// By default, shading is deferred: while the samples are rendered, the image
+// holds the normals of the visible points instead of their colors. Lighting is
+// computed once per pixel afterwards, so its cost depends on the resolution and
+// not on the number of samples, most of which end up hidden. The result is the
+// same as shading every sample.
+//
+// With `--stats`, the renderer measures how much time each stage of rendering
+// takes and counts what happens to the samples. Functions on the rendering
+// path are templates parametrized by whether the statistics are collected
+// (`Stats`), so that without `--stats` none of the bookkeeping is compiled in.
+//
+// Samples of a single frame can be rendered by multiple threads. Each thread
+// renders a contiguous range of sample rows into its own framebuffer,
+// and the results are merged afterwards (see `merge_thread_buffers`). No
+// synchronization is needed while rendering, and the merged frame is identical
+// to the one rendered by a single thread.
+//
+// Alternatively, whole frames can be rendered in parallel (see
+// `render_frames_in_parallel`). Frames depend only on their time, so they can
+// be rendered independently and written out in order once they are done.
+class renderer {
+public:
+    // Creates a renderer for a given job.
+    renderer(const render_settings& settings)
+    : _settings(settings),
+      _writers{frame_writer(settings.format), frame_writer(settings.format)},
+      // Bands of a frame have different sizes, so they are never spliced (see
+      // `frame_output`).
+      _frame_output(_output, settings.splice && settings.format != output_format::p3 && !banded()),
+      _pool(settings.threads),
+      _sample_cache(grid_columns(), grid_rows(), settings.sample_cache_budget),
+      _frame_cache(settings.frame_cache_budget, settings.frame_cache_directory) {
+        size_t width = settings.width;
+        size_t height = settings.height;
+
+        // With tiles, all threads draw to the same framebuffer (each of them
+        // to different tiles). Frames rendered in bands are drawn a band at a
+        // time.
+        for (size_t i = 0; i < (tiled() ? 1 : settings.threads); ++i) {
+            size_t rows = banded() ? settings.band_height : height;
+            if (settings.framebuffer == framebuffer_layout::packed) {
+                _packed_buffers.emplace_back(width, rows);
+            } else {
+                _split_buffers.emplace_back(width, rows);
+            }
+        }
+        if (tiled()) {
+            for (size_t i = 0; i < settings.threads; ++i) {
+                _tile_bins.emplace_back(width, height, settings.tile_size);
+            }
+        }
+        _scratch_buffers.resize(settings.threads);
+
+        // Camera is positioned at (0, 0, 0) and looks along the positive z
+        // axis. It follows the pinhole camera model (see
+        // https://en.wikipedia.org/wiki/Pinhole_camera_model for details).
+
+        // Field of view is 45 degrees.
+        const double fov = pi / 4;
+
+        // Given a field of view and an image size, compute the focal lengths.
+        auto fx = static_cast<real>(static_cast<double>(width) / 2 / std::tan(fov / 2));
+        auto fy = static_cast<real>(static_cast<double>(height) / 2 / std::tan(fov / 2));
+
+        auto ox = static_cast<real>(static_cast<double>(width) / 2);
+        auto oy = static_cast<real>(static_cast<double>(height) / 2);
+
+        // Camera matrix (also known as projection matrix) maps points in the
+        // view space to points in image. In this renderer, the view space is
+        // the same as the world space (Relations between world, view, and
+        // projection spaces are described here:
+        // https://learnopengl.com/Getting-started/Coordinate-Systems and there:
+        // https://gamedev.stackexchange.com/a/56203).
+        //
+        // See https://en.wikipedia.org/wiki/Camera_matrix and
+        // https://www.baeldung.com/cs/focal-length-intrinsic-camera-parameters#camera-intrinsic-matrix
+        // for details on how the camera matrix is constructed.
+        _camera_matrix = mat<3, 3>{{
+            {fx,  0, ox},
+            {0, -fy,  oy},
+            {0, 0, 1}
+        }};
+
+        std::vector<real> u(grid_columns());
+        for (size_t x = 0; x < u.size(); ++x) {
+            u[x] = sample_uv(x, 0)[0];
+        }
+        _grid_columns = _surface.sample_columns(u);
+
+        fill_sample_cache();
+        bound_patches();
+    }
+
+    // Changes the frame rate and the length (in seconds) of the animation.
+    // Neither of them is used to set up the renderer, so a renderer (with its
+    // buffers and caches) can be reused for jobs that differ only in them.
+    void set_animation(size_t fps, size_t length) {
+        _settings.fps = fps;
+        _settings.length = length;
+    }
+
+    // Renders the animation and writes it to `output` (stdout by default).
+    // Statistics are reported for this call only, so `render` can be called
+    // many times.
+    void render(output_stream output = output_stream()) {
+        _output = output;
+        _stats = {};
+        _adaptive_samples = 0;
+        _adaptive_evaluations = 0;
+
+        // The stream header is not a part of any frame, so frames stay the
+        // same (and can be cached) regardless of where they are in the stream.
+        if (first_frame() == 0) {
+            _output.write(_writers[0].stream_header(_settings.width, _settings.height, _settings.fps));
+        }
+
+        if (_settings.framebuffer == framebuffer_layout::packed) {
+            render_with_layout<packed_framebuffer>();
+        } else {
+            render_with_layout<split_framebuffer>();
+        }
+        _frame_output.wait();
+        _output.finish();
+
+        if (_settings.stats && _frame_cache.enabled()) {
+            std::cerr << "Frame cache: " << _frame_cache.hits() << " hits ("
+                      << _frame_cache.disk_hits() << " from disk), "
+                      << _frame_cache.misses() << " misses" << std::endl;
+        }
+
+        // Frames taken from the frame cache are not sampled.
+        size_t frames = _stats.frames;
+        if (_settings.stats && _settings.mode == render_mode::adaptive && frames > 0) {
+            size_t uniform = _settings.width * _settings.quality * _settings.height * _settings.quality;
+            std::cerr << "Adaptive sampling: " << _adaptive_samples / frames
+                      << " samples (" << _adaptive_evaluations / frames
+                      << " surface evaluations) per frame, uniform grid: "
+                      << uniform << " samples" << std::endl;
+        }
+
+        if (_settings.stats) {
+            report_stats();
+        }
+    }
+
+private:
+    // Benchmarks (see `src/bench.cc`) time the stages of rendering separately.
+    friend struct renderer_benchmarks;
+
+    size_t frame_count() const {
+        return _settings.fps * _settings.length;
+    }
+
+    // Range of frames to render (see `render_settings::frame_start`).
+    size_t first_frame() const {
+        return std::min(_settings.frame_start, frame_count());
+    }
+    size_t end_frame() const {
+        return first_frame() + std::min(_settings.frame_count, frame_count() - first_frame());
+    }
+
+    template <typename Framebuffer>
+    void render_with_layout() {
+        if (_settings.stats) {
+            render_frames<true, Framebuffer>();
+        } else {
+            render_frames<false, Framebuffer>();
+        }
+    }
+
+    template <bool Stats, typename Framebuffer>
+    void render_frames() {
+        if (_settings.frame_threads > 1) {
+            render_frames_in_parallel<Stats, Framebuffer>();
+            return;
+        }
+
+        // Frames are written by `_frame_output`'s thread while the next ones
+        // are rendered.
+        for (size_t frame = first_frame(); frame < end_frame(); ++frame) {
+            bool last = frame + 1 == end_frame();
+            // Bands are written out while the next ones are rendered, just
+            // like whole frames.
+            if (banded()) {
+                render_stats stats;
+                for (size_t row = 0; row < _settings.height; row += _settings.band_height) {
+                    {
+                        stage_timer<Stats> timer(stats.total);
+                        render_single_frame<Stats, Framebuffer>(frame_time(frame), row);
+                    }
+                    bool last_band = row + _settings.band_height >= _settings.height;
+                    send_frame<Stats>(thread_buffers<Framebuffer>()[0], last && last_band, stats, row);
+                }
+                if constexpr (Stats) {
+                    stats.total += stats.encoding;
+                }
+                add_stats<Stats>(stats);
+                continue;
+            }
+
+            auto key = frame_key(frame);
+            if (auto cached = _frame_cache.find(key)) {
+                _frame_output.send(*cached, last, cached);
+                continue;
+            }
+
+            render_stats stats;
+            {
+                stage_timer<Stats> timer(stats.total);
+                if (_settings.progressive_passes > 1) {
+                    render_progressive_frame<Stats, Framebuffer>(frame_time(frame));
+                } else {
+                    render_single_frame<Stats, Framebuffer>(frame_time(frame));
+                }
+            }
+
+            std::span<const unsigned char> encoded = send_frame<Stats>(thread_buffers<Framebuffer>()[0], last, stats);
+            if constexpr (Stats) {
+                stats.total += stats.encoding;
+            }
+            add_stats<Stats>(stats);
+            if (caches_frame(frame)) {
+                _frame_cache.insert(key, encoded);
+            }
+        }
+    }
+
+    // Encodes `frame` and sends it to `_frame_output`. Returns the encoded
+    // frame, which stays valid until the next frame is sent. Frames rendered
+    // in bands are sent a band at a time, the one starting with row
+    // `first_row` of the image.
+    //
+    // Frames are encoded by the two `_writers` in turn, so the buffer of the
+    // frame sent two frames ago is reused, which is allowed once the frame
+    // sent last is written (see `frame_output`). Only the encoding is timed,
+    // and not waiting for that.
+    template <bool Stats, typename Frame>
+    std::span<const unsigned char> send_frame(const Frame& frame, bool last, render_stats& stats, size_t first_row = 0) {
+        _frame_output.wait();
+
+        std::span<const unsigned char> encoded;
+        {
+            stage_timer<Stats> encoding(stats.encoding);
+            if (banded()) {
+                encoded = _writers[_next_writer].encode_band(frame, first_row, _settings.height);
+            } else {
+                encoded = _writers[_next_writer].encode(frame);
+            }
+        }
+        _next_writer = 1 - _next_writer;
+
+        _frame_output.send(encoded, last);
+        return encoded;
+    }
+
+    // Adds statistics collected by a thread to `_stats`.
+    template <bool Stats>
+    void add_stats(const render_stats& stats) {
+        if constexpr (Stats) {
+            std::lock_guard lock(_stats_mutex);
+            _stats += stats;
+        }
+    }
+
+    // Counts pixels of a finished frame, and adds them to `stats`.
+    template <typename Framebuffer>
+    static void count_pixels(Framebuffer& frame, render_stats& stats) {
+        for (size_t y = 0; y < frame.height(); ++y) {
+            for (size_t x = 0; x < frame.width(); ++x) {
+                if (frame.covered(x, y)) {
+                    ++stats.covered;
+                }
+            }
+        }
+        ++stats.frames;
+    }
+
+    // Prints the statistics collected in `_stats` to stderr.
+    void report_stats() const {
+        if (_stats.frames == 0) {
+            std::cerr << "Stats: no frames rendered" << std::endl;
+            return;
+        }
+
+        auto frames = static_cast<double>(_stats.frames);
+        auto milliseconds = [&](double seconds) { return seconds * 1000 / frames; };
+        auto percent = [&](size_t count) {
+            return _stats.samples == 0 ? 0.0 : 100.0 * static_cast<double>(count) / static_cast<double>(_stats.samples);
+        };
+
+        double stages = _stats.evaluation + _stats.projection + _stats.shading + _stats.encoding;
+        std::ostringstream report;
+        report << std::fixed << std::setprecision(2)
+               << "Stats: " << _stats.frames << " frames rendered, "
+               << milliseconds(_stats.total) << " ms per frame (stages summed over threads)\n"
+               << "  surface evaluation:    " << milliseconds(_stats.evaluation) << " ms\n"
+               << "  projection and z-test: " << milliseconds(_stats.projection) << " ms"
+               << (_settings.shading == shading_mode::forward ? " (includes shading)\n" : "\n")
+               << "  shading:               " << milliseconds(_stats.shading) << " ms\n"
+               << "  encoding:              " << milliseconds(_stats.encoding) << " ms\n"
+               << "  other:                 " << milliseconds(std::max(_stats.total - stages, 0.0))
+               << " ms\n"
+               << "  samples: " << _stats.samples / _stats.frames << " per frame, "
+               << percent(_stats.clipped) << "% clipped off-screen, "
+               << percent(_stats.rejected) << "% rejected by the z-test, "
+               << percent(_stats.culled) << "% in culled patches\n"
+               << "  overdraw: "
+               << (_stats.covered == 0 ? 0.0 : static_cast<double>(_stats.samples - _stats.clipped - _stats.culled)
+                                               / static_cast<double>(_stats.covered))
+               << " samples per covered pixel\n";
+        std::cerr << report.str() << std::flush;
+    }
+
+    // Time of frame number `frame` in seconds.
+    //
+    // The surface makes a full turn every 4 seconds, after which the animation
+    // repeats. Frames are mapped onto the first turn, so that the repeated
+    // frames are exactly the same and can be taken from the frame cache.
+    double frame_time(size_t frame) const {
+        return static_cast<double>(frame % (4 * _settings.fps)) / _settings.fps;
+    }
+
+    // Whether frame number `frame` is worth storing in `_frame_cache`: if it
+    // is rendered again later in this run (the animation repeats every 4
+    // seconds), or can be used by later runs or jobs. Otherwise copying it
+    // to the cache would only take time and memory.
+    bool caches_frame(size_t frame) const {
+        return frame + 4 * _settings.fps < end_frame() || _frame_cache.persistent() || _settings.reused;
+    }
+
+    // Describes everything the image of frame number `frame` depends on. Used
+    // as the key of `_frame_cache`.
+    //
+    // The version at the beginning has to be changed whenever the way frames
+    // are rendered changes, so that stale frames stored on disk are not used.
+    std::string frame_key(size_t frame) const {
+        std::string key = "heart-frame-v2";
+        key += " size=" + std::to_string(_settings.width) + "x" + std::to_string(_settings.height);
+        key += " quality=" + std::to_string(_settings.quality);
+        key += " mode=" + std::to_string(static_cast<int>(_settings.mode));
+        key += " format=" + std::to_string(static_cast<int>(_settings.format));
+        key += " framebuffer=" + std::to_string(static_cast<int>(_settings.framebuffer));
+        if (_settings.framebuffer == framebuffer_layout::packed) {
+            // Packed framebuffers store normals with less precision than
+            // colors, so the shading mode changes the images a little.
+            key += " shading=" + std::to_string(static_cast<int>(_settings.shading));
+        }
+        key += std::is_same_v<real, float> ? " float" : " double";
+
+        // Transforms are compared exactly, so their elements are written in
+        // the hexadecimal floating-point format.
+        key += " transform=";
+        auto transform = translate(_surface_position) * rotation_at(frame_time(frame));
+        for (const auto& row : transform) {
+            for (real value : row) {
+                char digits[32];
+                auto [end, ec] = std::to_chars(
+                    std::begin(digits), std::end(digits), value, std::chars_format::hex
+                );
+                key.append(digits, end);
+                key += ',';
+            }
+        }
+        return key;
+    }
+
+    // Size of the sample grid. In the `points` mode, the grid has `quality`
+    // samples per pixel along each axis. In the `raster` mode, it holds the
+    // vertices of the mesh: one column per pixel (the last column is connected
+    // back to the first one, as the surface is closed along `u`) and one row
+    // per pixel plus one.
+    //
+    // The `adaptive` mode doesn't use the grid.
+    size_t grid_columns() const {
+        if (_settings.mode == render_mode::raster) {
+            return _settings.width;
+        }
+        if (_settings.mode == render_mode::adaptive) {
+            return 0;
+        }
+        return _settings.width * _settings.quality;
+    }
+
+    size_t grid_rows() const {
+        if (_settings.mode == render_mode::raster) {
+            return _settings.height + 1;
+        }
+        if (_settings.mode == render_mode::adaptive) {
+            return 0;
+        }
+        return _settings.height * _settings.quality;
+    }
+
+    // Number of rows of work that can be split between threads: rows of
+    // samples, rows of mesh cells, or rows of the initial adaptive cells.
+    size_t work_rows() const {
+        if (_settings.mode == render_mode::raster) {
+            return grid_rows() - 1;
+        }
+        if (_settings.mode == render_mode::adaptive) {
+            return adaptive_grid;
+        }
+        return grid_rows();
+    }
+
+    // The normal is undefined at the poles (v = 0 and v = 1), so samples there
+    // are moved inside by this tiny bit.
+    static constexpr double pole_offset = 1e-6;
+
+    // Parameters of the surface sampled at position (x, y) of the sample grid.
+    vec<2> sample_uv(size_t x, size_t y) const {
+        if (_settings.mode == render_mode::raster) {
+            // Mesh vertices lie on the edges of the parameter domain, so the
+            // ones at the poles have to be moved inside (see `pole_offset`).
+            double v = static_cast<double>(y) / _settings.height;
+            return {
+                static_cast<real>(static_cast<double>(x) / _settings.width),
+                static_cast<real>(std::clamp(v, pole_offset, 1 - pole_offset))
+            };
+        }
+        return {
+            static_cast<real>((x + 0.5) / _settings.width / _settings.quality),
+            static_cast<real>((y + 0.5) / _settings.height / _settings.quality)
+        };
+    }
+
+    // Samples the surface at the grid rows that fit in the sample cache.
+    void fill_sample_cache() {
+        if (_sample_cache.rows() == 0) {
+            return;
+        }
+
+        // Frame-parallel mode doesn't use `_pool`, but it has threads to spare.
+        thread_pool frame_pool(_settings.frame_threads);
+        thread_pool& pool = _settings.frame_threads > 1 ? frame_pool : _pool;
+
+        size_t rows = _sample_cache.rows();
+        size_t columns = grid_columns();
+        size_t threads = pool.size();
+        pool.run(threads, [&](size_t thread) {
+            for (size_t y = rows * thread / threads; y < rows * (thread + 1) / threads; ++y) {
+                _surface.sample_model_row(_grid_columns, sample_uv(0, y)[1], _sample_cache.points(), y * columns);
+            }
+        });
+
+        if (_settings.stats) {
+            std::cerr << "Sample cache: " << rows << " of "
+                      << grid_rows() << " sample rows, "
+                      << (_sample_cache.memory_usage() >> 20) << " MiB" << std::endl;
+        }
+    }
+
+    // Finds the bounds of all patches of the sample grid (see `patch_bounds`)
+    // if they are used. Rows of the sample cache are taken from it, the
+    // others are sampled.
+    void bound_patches() {
+        if (!bounds_patches()) {
+            return;
+        }
+
+        size_t columns = grid_columns();
+        size_t rows = grid_rows();
+        size_t patch_columns = (columns + patch_size - 1) / patch_size;
+        size_t patch_rows = (rows + patch_size - 1) / patch_size;
+        _patches.resize(patch_columns * patch_rows);
+
+        // The model transform scales distances uniformly, and the world
+        // transforms don't change them.
+        auto origin = from_homogeneus(_surface.to_world(surface::point{}).position);
+        auto unit = from_homogeneus(_surface.to_world(surface::point{{1, 0, 0, 1}}).position);
+        real scale = length(unit - origin);
+
+        // Positions have to be bounded exactly. The cone only decides which
+        // patches are drawn last, so it is estimated from every
+        // `normal_stride`-th normal along each direction.
+        const size_t normal_stride = 4;
+
+        thread_pool frame_pool(_settings.frame_threads);
+        thread_pool& pool = _settings.frame_threads > 1 ? frame_pool : _pool;
+
+        size_t threads = pool.size();
+        pool.run(threads, [&](size_t thread) {
+            surface::point_array band;
+            std::vector<vec<3>> normals;
+            for (size_t py = patch_rows * thread / threads; py < patch_rows * (thread + 1) / threads; ++py) {
+                size_t first_row = py * patch_size;
+                size_t last_row = std::min(rows, first_row + patch_size);
+                band.resize(columns * (last_row - first_row));
+                for (size_t y = std::max(first_row, _sample_cache.rows()); y < last_row; ++y) {
+                    _surface.sample_model_row(_grid_columns, sample_uv(0, y)[1], band, (y - first_row) * columns);
+                }
+
+                // Coordinates (see `surface::point_array`) of row `y`.
+                auto row = [&](size_t y) {
+                    bool cached = y < _sample_cache.rows();
+                    const auto& points = cached ? _sample_cache.points() : band;
+                    size_t offset = (cached ? y : y - first_row) * columns;
+                    std::array<const real*, 6> coordinates;
+                    for (size_t c = 0; c < 6; ++c) {
+                        coordinates[c] = points.coordinates[c].data() + offset;
+                    }
+                    return coordinates;
+                };
+
+                for (size_t px = 0; px < patch_columns; ++px) {
+                    size_t first_column = px * patch_size;
+                    size_t last_column = std::min(columns, first_column + patch_size);
+
+                    // The sphere is centered at the middle sample, which
+                    // for small patches is almost as tight as it gets.
+                    auto middle = row((first_row + last_row) / 2);
+                    size_t middle_column = (first_column + last_column) / 2;
+                    vec<3> center = {middle[0][middle_column], middle[1][middle_column], middle[2][middle_column]};
+
+                    real squared_radius = 0;
+                    for (size_t y = first_row; y < last_row; ++y) {
+                        auto coordinates = row(y);
+                        for (size_t x = first_column; x < last_column; ++x) {
+                            vec<3> offset = {
+                                coordinates[0][x] - center[0],
+                                coordinates[1][x] - center[1],
+                                coordinates[2][x] - center[2]
+                            };
+                            squared_radius = std::max(squared_radius, dot(offset, offset));
+                        }
+                    }
+
+                    normals.clear();
+                    bool degenerate = false;
+                    vec<3> sum = {0, 0, 0};
+                    for (size_t y = first_row; y < last_row; y += normal_stride) {
+                        auto coordinates = row(y);
+                        for (size_t x = first_column; x < last_column; x += normal_stride) {
+                            vec<3> normal = {coordinates[3][x], coordinates[4][x], coordinates[5][x]};
+                            if (!(length(normal) > 0)) {
+                                degenerate = true;
+                                continue;
+                            }
+                            normals.push_back(normalize(normal));
+                            sum = sum + normals.back();
+                        }
+                    }
+
+                    // Patches with normals of no direction, or in all
+                    // directions, are never back-facing.
+                    vec<3> axis = {1, 0, 0};
+                    real spread = static_cast<real>(pi);
+                    if (!degenerate && length(sum) > 0) {
+                        axis = normalize(sum);
+                        real cosine = 1;
+                        for (const auto& normal : normals) {
+                            cosine = std::min(cosine, dot(axis, normal));
+                        }
+                        spread = std::acos(std::clamp(cosine, real(-1), real(1)));
+                    }
+
+                    _patches[px + py * patch_columns] = {
+                        {to_homogeneus(center), {axis[0], axis[1], axis[2], 0}},
+                        std::sqrt(squared_radius) * scale,
+                        spread
+                    };
+                }
+            }
+        });
+    }
+
+    // Rotation of the surface in the frame at time `t` (in seconds).
+    mat<4, 4> rotation_at(double t) const {
+        // Derive surface rotation angle from frame's time.
+        auto angle = t * pi / 2;
+        return rotate_along_y(static_cast<real>(angle));
+    }
+
+    // Returns the surface positioned as in the frame at time `t` (in seconds).
+    surface surface_at(double t) const {
+        // Rotate the surface around y axis and move it to `_surface_position`.
+        auto normal = rotation_at(t);
+        auto transform = translate(_surface_position) * normal;
+
+        surface result = _surface;
+        result.set_transform(transform, normal);
+        return result;
+    }
+
+    // Framebuffers of the threads rendering a frame, for the given layout.
+    // The first one holds the finished frame.
+    template <typename Framebuffer>
+    std::vector<Framebuffer>& thread_buffers() {
+        if constexpr (std::is_same_v<Framebuffer, packed_framebuffer>) {
+            return _packed_buffers;
+        } else {
+            return _split_buffers;
+        }
+    }
+
+    // Renders a single frame of the animation to the first of the
+    // `thread_buffers`. The frame is determined by the time `t` in seconds.
+    // Frames rendered in bands are rendered a band at a time, the one
+    // starting with row `first_row`.
+    template <bool Stats, typename Framebuffer>
+    void render_single_frame(double t, size_t first_row = 0) {
+        surface frame_surface = surface_at(t);
+
+        size_t threads = _pool.size();
+        auto& buffers = thread_buffers<Framebuffer>();
+        if (tiled()) {
+            auto run = [&](size_t count, const std::function<void(size_t)>& task) {
+                _pool.run(count, task);
+            };
+            buffers[0].clear();
+            render_tiled<Stats>(frame_surface, buffers[0], _tile_bins, _scratch_buffers, run);
+        } else {
+            render_untiled<Stats>(frame_surface, buffers, first_row);
+        }
+
+        if (_settings.shading == shading_mode::deferred) {
+            size_t height = buffers[0].height();
+            _pool.run(threads, [&](size_t thread) {
+                render_stats stats;
+                {
+                    stage_timer<Stats> timer(stats.shading);
+                    shade_rows(height * thread / threads, height * (thread + 1) / threads, buffers[0]);
+                }
+                add_stats<Stats>(stats);
+            });
+        }
+
+        if constexpr (Stats) {
+            render_stats stats;
+            count_pixels(buffers[0], stats);
+            // Frames rendered in bands are counted with their first band.
+            stats.frames = first_row == 0 ? 1 : 0;
+            add_stats<Stats>(stats);
+        }
+    }
+
+    // Renders a frame of `frame_surface` (or its band starting with row
+    // `first_row`) with every thread drawing points straight into its own
+    // framebuffer, and merges the framebuffers into the first one.
+    template <bool Stats, typename Framebuffer>
+    void render_untiled(const surface& frame_surface, std::vector<Framebuffer>& buffers, size_t first_row = 0) {
+        // Rows of samples are split into contiguous ranges, one per thread.
+        // Thread `i` renders rows [rows * i / n, rows * (i + 1) / n).
+        size_t rows = work_rows();
+        size_t threads = _pool.size();
+        _pool.run(threads, [&](size_t thread) {
+            Framebuffer& frame = buffers[thread];
+            frame.clear();
+
+            render_stats stats;
+            render_rows<Stats>(
+                frame_surface,
+                rows * thread / threads,
+                rows * (thread + 1) / threads,
+                frame,
+                _scratch_buffers[thread],
+                stats,
+                first_row
+            );
+            add_stats<Stats>(stats);
+        });
+
+        // Merging picks the closest samples, so it is a part of the z-test.
+        render_stats stats;
+        {
+            stage_timer<Stats> timer(stats.projection);
+            merge_thread_buffers(buffers);
+        }
+        add_stats<Stats>(stats);
+    }
+
+    // Renders a single frame of the animation (see `render_single_frame`) in
+    // `progressive_passes` passes, writing a preview of the frame to the output
+    // after every pass but the last one.
+    //
+    // Pass `p` (counting from 0) draws the grid samples whose both
+    // coordinates are multiples of `stride(p)` and which weren't drawn by an
+    // earlier pass. The stride halves with every pass and is 1 for the last
+    // one, so the first pass takes every `2^(passes - 1)`-th sample along
+    // each axis, spread evenly over the frame, and each pass makes the
+    // sampled lattice twice as dense.
+    //
+    // Samples are drawn through an `ordered_target`, so that the finished
+    // frame is the same as the one rendered in a single pass.
+    template <bool Stats, typename Framebuffer>
+    void render_progressive_frame(double t) {
+        surface frame_surface = surface_at(t);
+        Framebuffer& frame = thread_buffers<Framebuffer>()[0];
+        frame.clear();
+        _progressive_indices.resize(_settings.width * _settings.height);
+        ordered_target<Framebuffer> target{frame, _progressive_indices};
+
+        size_t passes = _settings.progressive_passes;
+        auto stride = [&](size_t pass) {
+            return size_t{1} << (passes - 1 - pass);
+        };
+
+        std::vector<size_t> columns;
+        surface::grid_columns selected;
+        surface::point_array points;
+        for (size_t pass = 0; pass < passes; ++pass) {
+            render_stats stats;
+            size_t step = stride(pass);
+            for (size_t y = 0; y < grid_rows(); y += step) {
+                // Rows on the previous pass's lattice already have every
+                // other sample drawn.
+                bool drawn_row = pass > 0 && y % stride(pass - 1) == 0;
+                columns.clear();
+                for (size_t x = drawn_row ? step : 0; x < grid_columns(); x += drawn_row ? 2 * step : step) {
+                    columns.push_back(x);
+                }
+
+                // Rows in the sample cache are moved to the world coordinates
+                // as a whole, other rows are sampled only where needed.
+                bool cached = y < _sample_cache.rows();
+                {
+                    stage_timer<Stats> timer(cached ? stats.projection : stats.evaluation);
+                    if (cached) {
+                        frame_surface.to_world(_sample_cache.points(), y * grid_columns(), grid_columns(), points);
+                    } else {
+                        selected.select(_grid_columns, columns);
+                        frame_surface.sample_row(selected, sample_uv(0, y)[1], points);
+                    }
+                }
+
+                stage_timer<Stats> timer(stats.projection);
+                for (size_t i = 0; i < columns.size(); ++i) {
+                    target.index = y * grid_columns() + columns[i];
+                    render_single_sample<Stats>(points[cached ? columns[i] : i], target, stats);
+                }
+            }
+
+            if (pass + 1 < passes) {
+                write_preview<Stats>(frame, (step + _settings.quality - 1) / _settings.quality, stats);
+            }
+            add_stats<Stats>(stats);
+        }
+
+        render_stats stats;
+        if (_settings.shading == shading_mode::deferred) {
+            stage_timer<Stats> timer(stats.shading);
+            shade_rows(0, _settings.height, frame);
+        }
+        if constexpr (Stats) {
+            count_pixels(frame, stats);
+        }
+        add_stats<Stats>(stats);
+    }
+
+    // Writes a preview of a partially rendered `frame` to the output, in which
+    // the samples drawn so far, about `gap` pixels apart, are stretched to
+    // cover the pixels between them.
+    template <bool Stats, typename Framebuffer>
+    void write_preview(const Framebuffer& frame, size_t gap, render_stats& stats) {
+        Framebuffer preview = frame;
+        if (_settings.shading == shading_mode::deferred) {
+            stage_timer<Stats> timer(stats.shading);
+            shade_rows(0, _settings.height, preview);
+        }
+
+        // Every pixel that is not covered takes the color of the closest
+        // covered pixel less than `gap` pixels to the left, and then the same
+        // is done upwards.
+        size_t width = _settings.width;
+        size_t height = _settings.height;
+        for (size_t y = 0; y < height; ++y) {
+            size_t last = width;
+            for (size_t x = 0; x < width; ++x) {
+                if (preview.covered(x, y)) {
+                    last = x;
+                } else if (last != width && x - last < gap) {
+                    preview.copy_pixel(last, y, x, y);
+                }
+            }
+        }
+        for (size_t x = 0; x < width; ++x) {
+            size_t last = height;
+            for (size_t y = 0; y < height; ++y) {
+                if (preview.covered(x, y)) {
+                    last = y;
+                } else if (last != height && y - last < gap) {
+                    preview.copy_pixel(x, last, x, y);
+                }
+            }
+        }
+
+        send_frame<Stats>(preview, false, stats);
+    }
+
+    // Whether points are binned into tiles before they are drawn.
+    bool tiled() const {
+        return _settings.tile_size > 0 && _settings.mode != render_mode::raster;
+    }
+
+    // Upper bound on the number of points binned at once, which bounds the
+    // memory taken by the bins.
+    static constexpr size_t tile_batch_samples = 1 << 20;
+
+    // Buffers a thread reuses between rows of work and frames (defined with
+    // the buffers they hold, see below).
+    struct scratch_buffers;
+
+    // Renders a frame of `frame_surface` in two passes: points are binned
+    // into screen tiles first, and then every tile is drawn on its own.
+    //
+    // `bins` holds the bins of each thread, and `scratch` its other buffers.
+    // Threads bin points of contiguous ranges of rows, and tiles are drawn
+    // from the bins in thread order, so every pixel sees its points in the
+    // same order as when they are drawn directly by a single thread, and the
+    // frame is the same. A tile is drawn by a single thread, so the threads
+    // don't need to synchronize.
+    //
+    // Work rows are processed in batches of about `tile_batch_samples`
+    // points. `run(count, task)` runs `task(i)` for all `i` in [0, count),
+    // possibly in parallel.
+    template <bool Stats, typename Framebuffer, typename Run>
+    void render_tiled(
+        const surface& frame_surface,
+        Framebuffer& frame,
+        std::vector<tile_bins>& bins,
+        std::vector<scratch_buffers>& scratch,
+        const Run& run
+    ) {
+        // Number of points in a work row (for the adaptive mode, the number a
+        // uniform grid of the same quality would have).
+        size_t row_samples = grid_columns();
+        if (_settings.mode == render_mode::adaptive) {
+            row_samples = grid_columns() * grid_rows() / adaptive_grid;
+        }
+
+        size_t rows = work_rows();
+        size_t threads = bins.size();
+        size_t batch = std::max(threads, tile_batch_samples / std::max<size_t>(row_samples, 1));
+        for (size_t begin = 0; begin < rows; begin += batch) {
+            size_t count = std::min(batch, rows - begin);
+            run(threads, [&](size_t thread) {
+                bins[thread].clear();
+                binning_target<Framebuffer> target{frame, bins[thread]};
+                render_stats stats;
+                size_t first = begin + count * thread / threads;
+                size_t last = begin + count * (thread + 1) / threads;
+                if (_settings.mode == render_mode::adaptive) {
+                    render_adaptive_rows<Stats>(frame_surface, first, last, target, scratch[thread].adaptive, stats);
+                } else {
+                    render_sample_rows<Stats>(frame_surface, first, last, target, stats);
+                }
+                add_stats<Stats>(stats);
+            });
+
+            run(bins[0].tiles(), [&](size_t tile) {
+                render_stats stats;
+                {
+                    stage_timer<Stats> timer(stats.projection);
+                    draw_tile<Stats>(tile, bins, frame, stats);
+                }
+                add_stats<Stats>(stats);
+            });
+        }
+    }
+
+    // Draws points binned into the tile number `tile` to the `frame`.
+    template <bool Stats, typename Framebuffer>
+    void draw_tile(
+        size_t tile,
+        const std::vector<tile_bins>& bins,
+        Framebuffer& frame,
+        render_stats& stats
+    ) const {
+        for (const auto& thread_bins : bins) {
+            for (const auto& point : thread_bins.tile(tile)) {
+                if (frame.occluded(point.x, point.y, point.z)) {
+                    if constexpr (Stats) {
+                        ++stats.rejected;
+                    }
+                    continue;
+                }
+                const vec<3>& normal = point.normal;
+                store(frame, point.x, point.y, point.z, {normal[0], normal[1], normal[2], 0});
+            }
+        }
+    }
+
+    // Size of the square patches of the sample grid (in samples along each
+    // side) that are culled as a whole (see `render_culled_rows`).
+    static constexpr size_t patch_size = 16;
+
+    // Bounds of the points of a patch of the sample grid, found once, when
+    // the renderer is created: a sphere holding their positions, and a cone
+    // holding the directions of their normals.
+    struct patch_bounds {
+        // Center of the sphere, and the axis of the cone (of unit length), in
+        // the surface's own coordinate system.
+        surface::point center;
+
+        // Radius of the sphere in world coordinates. Frames only rotate and
+        // move the surface, so it is the same in all of them.
+        real radius;
+
+        // Largest angle between the axis and a normal, in radians.
+        real spread;
+    };
+
+    enum class patch_visibility {
+        // All points of the patch are off the image.
+        off_screen,
+        // Some points of the patch may face the camera.
+        front_facing,
+        // All points of the patch face away from the camera.
+        back_facing,
+    };
+
+    // Where a patch is in a frame (see `view_patch`).
+    struct patch_view {
+        patch_visibility visibility;
+
+        // Pixels that points of the patch can be drawn to: [x0, x1] x [y0, y1].
+        size_t x0;
+        size_t y0;
+        size_t x1;
+        size_t y1;
+
+        // Smallest depth of the points of the patch.
+        real z;
+    };
+
+    // A back-facing patch, waiting to be drawn after the other ones: column
+    // `column` of the patches, clipped to rows [first_row, last_row) of the
+    // sample grid.
+    struct deferred_patch {
+        size_t column;
+        size_t first_row;
+        size_t last_row;
+        patch_view view;
+    };
+
+    // Buffers of a thread rendering with patch culling (see
+    // `render_culled_rows`).
+    struct culling_buffers {
+        // Indices of the samples drawn to the pixels (see `ordered_target`).
+        std::vector<size_t> indices;
+
+        depth_pyramid pyramid;
+
+        // Views of the patches in a row of patches, and the back-facing
+        // patches drawn last.
+        std::vector<patch_view> views;
+        std::vector<deferred_patch> deferred;
+    };
+
+    // Whether hidden patches of the sample grid are culled.
+    bool culls_patches() const {
+        return _settings.culling
+            && _settings.mode == render_mode::points
+            && !tiled()
+            && _settings.progressive_passes == 1;
+    }
+
+    // Whether frames are rendered in bands (see `render_settings::band_height`).
+    bool banded() const {
+        return _settings.band_height > 0 && _settings.band_height < _settings.height;
+    }
+
+    // Whether the bounds of the patches are used, to cull them or to find the
+    // ones in a band.
+    bool bounds_patches() const {
+        return culls_patches() || banded();
+    }
+
+    // Finds where a patch with the given bounds is in the frame of
+    // `frame_surface`. The results are conservative: all points of the patch
+    // fall into the pixels of the view, no point is closer than its depth, and
+    // `back_facing` patches are back-facing.
+    patch_view view_patch(const surface& frame_surface, const patch_bounds& patch) const {
+        surface::point center = frame_surface.to_world(patch.center);
+        vec<3> c = from_homogeneus(center.position);
+
+        // Points of the patch are transformed with different rounding than
+        // its center, the margin covers the difference.
+        real r = patch.radius * real(1.001) + real(1e-4);
+
+        patch_view view{
+            patch_visibility::front_facing,
+            0, 0, _settings.width - 1, _settings.height - 1,
+            std::numeric_limits<real>::lowest()
+        };
+        if (c[2] - r < real(1e-3)) {
+            // The sphere reaches behind the camera, its projection is
+            // unbounded.
+            return view;
+        }
+        view.z = c[2] - r;
+
+        // Image coordinates are affine in x / z and y / z, which over the box
+        // around the sphere are extreme at its corners.
+        vec<2> low = {std::numeric_limits<real>::max(), std::numeric_limits<real>::max()};
+        vec<2> high = {std::numeric_limits<real>::lowest(), std::numeric_limits<real>::lowest()};
+        for (real dz : {-r, r}) {
+            for (real d : {-r, r}) {
+                vec<2> corner = from_homogeneus(_camera_matrix * vec<3>{c[0] + d, c[1] + d, c[2] + dz});
+                for (size_t i = 0; i < 2; ++i) {
+                    low[i] = std::min(low[i], corner[i]);
+                    high[i] = std::max(high[i], corner[i]);
+                }
+            }
+        }
+
+        // Image positions are truncated to pixels (see `render_single_sample`),
+        // and rounded differently than here. A pixel of margin covers both.
+        auto width = static_cast<real>(_settings.width);
+        auto height = static_cast<real>(_settings.height);
+        real x0 = std::floor(low[0]) - 1;
+        real y0 = std::floor(low[1]) - 1;
+        real x1 = std::floor(high[0]) + 1;
+        real y1 = std::floor(high[1]) + 1;
+        if (x1 < 0 || y1 < 0 || x0 >= width || y0 >= height) {
+            view.visibility = patch_visibility::off_screen;
+            return view;
+        }
+        view.x0 = static_cast<size_t>(std::max(x0, real(0)));
+        view.y0 = static_cast<size_t>(std::max(y0, real(0)));
+        view.x1 = static_cast<size_t>(std::min(x1, width - 1));
+        view.y1 = static_cast<size_t>(std::min(y1, height - 1));
+
+        // Normals of the surface point inwards, so a point faces away from the
+        // camera if the angle between its normal and the direction from it to
+        // the camera is below 90 degrees. For the patch, the directions to its
+        // points deviate from the direction to the center by at most `apex`.
+        vec<3> axis = {center.normal[0], center.normal[1], center.normal[2]};
+        real distance = length(c);
+        real angle = std::acos(std::clamp(-dot(axis, c) / distance, real(-1), real(1)));
+        real apex = std::asin(std::min(r / distance, real(1)));
+        if (angle + patch.spread + apex < real(pi / 2) - real(1e-3)) {
+            view.visibility = patch_visibility::back_facing;
+        }
+        return view;
+    }
+
+    // Renders samples from rows [begin, end) of the sample grid to `frame`,
+    // like `render_sample_rows`, skipping patches of the grid (see
+    // `patch_size`) that can't change the frame.
+    //
+    // When frames are rendered in bands, `frame` holds the band of the image
+    // starting with row `first_row`, and patches whose points all fall
+    // outside of it are skipped too, so that every band evaluates only the
+    // samples that can land in it. The others are drawn in order, so the band
+    // is the same as the rows of the whole frame. Without culling, such
+    // patches are the only ones skipped.
+    //
+    // Patches off the image are skipped right away. Back-facing patches are
+    // usually hidden behind the front of the surface, so they are drawn last:
+    // the other patches are drawn first, then a depth pyramid is built from
+    // the frame, and back-facing patches that are behind it are skipped (all
+    // their points would be rejected by the z-test). Points are drawn through
+    // an `ordered_target`, so drawing some patches after the others doesn't
+    // change the frame either.
+    template <bool Stats, typename Framebuffer>
+    void render_culled_rows(
+        const surface& frame_surface,
+        size_t begin,
+        size_t end,
+        Framebuffer& frame,
+        culling_buffers& culling,
+        render_stats& stats,
+        size_t first_row = 0
+    ) const {
+        size_t columns = grid_columns();
+        size_t patch_columns = (columns + patch_size - 1) / patch_size;
+        size_t band_end = first_row + frame.height();
+        culling.indices.resize(frame.width() * frame.height());
+        culling.views.resize(patch_columns);
+        culling.deferred.clear();
+        ordered_target<Framebuffer> ordered{frame, culling.indices};
+        band_target<ordered_target<Framebuffer>> target{ordered, first_row, _settings.height};
+        surface::point_array points;
+
+        // Draws `count` samples of row `y`, starting with column `first`.
+        auto draw = [&](size_t y, size_t first, size_t count) {
+            {
+                stage_timer<Stats> timer(y < _sample_cache.rows() ? stats.projection : stats.evaluation);
+                sample_row(frame_surface, y, points, first, count);
+            }
+
+            stage_timer<Stats> timer(stats.projection);
+            for (size_t i = 0; i < count; ++i) {
+                ordered.index = y * columns + first + i;
+                render_single_sample<Stats>(points[i], target, stats);
+            }
+        };
+        auto cull = [&](size_t count) {
+            if constexpr (Stats) {
+                stats.samples += count;
+                stats.culled += count;
+            }
+        };
+        auto patch_width = [&](size_t column) {
+            return std::min(columns, (column + 1) * patch_size) - column * patch_size;
+        };
+
+        for (size_t py = begin / patch_size; py * patch_size < end; ++py) {
+            size_t first_sample_row = std::max(begin, py * patch_size);
+            size_t last_sample_row = std::min(end, (py + 1) * patch_size);
+            {
+                stage_timer<Stats> timer(stats.projection);
+                for (size_t px = 0; px < patch_columns; ++px) {
+                    patch_view view = view_patch(frame_surface, _patches[px + py * patch_columns]);
+                    // Patches off the image are counted once, with the first
+                    // band.
+                    if (view.visibility == patch_visibility::off_screen && first_row == 0) {
+                        cull(patch_width(px) * (last_sample_row - first_sample_row));
+                    }
+                    if (view.y1 < first_row || view.y0 >= band_end) {
+                        view.visibility = patch_visibility::off_screen;
+                    } else if (view.visibility == patch_visibility::back_facing) {
+                        if (_settings.culling) {
+                            culling.deferred.push_back({px, first_sample_row, last_sample_row, view});
+                        } else {
+                            view.visibility = patch_visibility::front_facing;
+                        }
+                    }
+                    culling.views[px] = view;
+                }
+            }
+
+            // Front-facing patches next to each other are drawn together, row
+            // by row.
+            for (size_t y = first_sample_row; y < last_sample_row; ++y) {
+                size_t px = 0;
+                while (px < patch_columns) {
+                    if (culling.views[px].visibility != patch_visibility::front_facing) {
+                        ++px;
+                        continue;
+                    }
+                    size_t run_end = px;
+                    while (run_end < patch_columns && culling.views[run_end].visibility == patch_visibility::front_facing) {
+                        ++run_end;
+                    }
+                    draw(y, px * patch_size, std::min(columns, run_end * patch_size) - px * patch_size);
+                    px = run_end;
+                }
+            }
+        }
+
+        if (culling.deferred.empty()) {
+            return;
+        }
+        {
+            stage_timer<Stats> timer(stats.projection);
+            culling.pyramid.build(frame);
+        }
+        for (const auto& patch : culling.deferred) {
+            const patch_view& view = patch.view;
+            size_t first = patch.column * patch_size;
+            size_t count = patch_width(patch.column);
+            // The pyramid covers the rows of the band.
+            size_t y0 = std::max(view.y0, first_row) - first_row;
+            size_t y1 = std::min(view.y1, band_end - 1) - first_row;
+            if (culling.pyramid.occludes(view.x0, y0, view.x1, y1, view.z)) {
+                cull(count * (patch.last_row - patch.first_row));
+                continue;
+            }
+            for (size_t y = patch.first_row; y < patch.last_row; ++y) {
+                draw(y, first, count);
+            }
+        }
+    }
+
+    // Renders rows [begin, end) of work (see `work_rows`) to the `frame`
+    // buffer, using the thread's `scratch` buffers.
+    // Frames rendered in bands are drawn to `frame` a band at a time, the one
+    // starting with row `first_row` of the image.
+    template <bool Stats, typename Framebuffer>
+    void render_rows(
+        const surface& frame_surface,
+        size_t begin,
+        size_t end,
+        Framebuffer& frame,
+        scratch_buffers& scratch,
+        render_stats& stats,
+        size_t first_row = 0
+    ) const {
+        if (_settings.mode == render_mode::raster) {
+            rasterize_rows<Stats>(frame_surface, begin, end, frame, stats);
+        } else if (_settings.mode == render_mode::adaptive) {
+            render_adaptive_rows<Stats>(frame_surface, begin, end, frame, scratch.adaptive, stats);
+        } else if (bounds_patches()) {
+            render_culled_rows<Stats>(frame_surface, begin, end, frame, scratch.culling, stats, first_row);
+        } else {
+            render_sample_rows<Stats>(frame_surface, begin, end, frame, stats);
+        }
+    }
+
+    // Renders samples from rows [begin, end) of the sample grid to the `img`
+    // buffer.
+    template <bool Stats, typename Framebuffer>
+    void render_sample_rows(
+        const surface& frame_surface,
+        size_t begin,
+        size_t end,
+        Framebuffer& frame,
+        render_stats& stats
+    ) const {
+        size_t columns = grid_columns();
+
+        // Points of a row, in world coordinates.
+        surface::point_array row_points;
+
+        // Sample the [0, 1] x [0, 1] square `quality^2` times per pixel.
+        // Render the surface at each sample point. Points from the sample cache
+        // only need to be moved to the world coordinates.
+        for (size_t y = begin; y < end; ++y) {
+            {
+                stage_timer<Stats> timer(y < _sample_cache.rows() ? stats.projection : stats.evaluation);
+                sample_row(frame_surface, y, row_points);
+            }
+
+            stage_timer<Stats> timer(stats.projection);
+            for (size_t x = 0; x < columns; ++x) {
+                render_single_sample<Stats>(row_points[x], frame, stats);
+            }
+        }
+    }
+
+    // Samples row `y` of the sample grid into `points` (in world
+    // coordinates), moving the cached points if the row is in the sample
+    // cache. Only columns [first, first + count) are sampled, by default all
+    // of them.
+    void sample_row(
+        const surface& frame_surface,
+        size_t y,
+        surface::point_array& points,
+        size_t first = 0,
+        size_t count = std::numeric_limits<size_t>::max()
+    ) const {
+        size_t columns = grid_columns();
+        count = std::min(count, columns - first);
+        if (y < _sample_cache.rows()) {
+            frame_surface.to_world(_sample_cache.points(), y * columns + first, count, points);
+            return;
+        }
+
+        frame_surface.sample_row(_grid_columns, sample_uv(0, y)[1], points, first, count);
+    }
+
+    // Number of rows and columns of the cells the adaptive sampler starts with.
+    // The cells have to be small enough for their corners to tell how large
+    // they are on the image.
+    static constexpr size_t adaptive_grid = 64;
+
+    // Maximum number of times an initial cell can be subdivided.
+    static constexpr size_t adaptive_max_depth = 12;
+
+    // Number of lattice steps per unit of the parameter domain. Corners of
+    // all cells lie on this lattice: the initial cells are `adaptive_grid`
+    // by `adaptive_grid`, and every subdivision halves a cell along some of
+    // its directions. Parameters of the lattice points are exact.
+    static constexpr uint32_t adaptive_lattice = adaptive_grid << adaptive_max_depth;
+
+    // A rectangle of the parameter domain: its top-left corner on the lattice
+    // (see `adaptive_lattice`), its size along `u` and `v` (`2^u_shift` and
+    // `2^v_shift` lattice steps), and the indices of the surface points at
+    // its top-left, top-right, bottom-left and bottom-right corners (see
+    // `adaptive_buffers::points`).
+    struct adaptive_cell {
+        uint32_t u;
+        uint32_t v;
+        uint32_t u_shift;
+        uint32_t v_shift;
+        std::array<uint32_t, 4> corners;
+    };
+
+    // A cell (given by its index) being split into a grid of `columns` x
+    // `rows` points (2 or 3 along each direction). Indices of the points
+    // are kept in `adaptive_buffers::grid`, starting at `first_point`.
+    struct adaptive_split {
+        size_t cell;
+        uint32_t columns;
+        uint32_t rows;
+        size_t first_point;
+    };
+
+    // Buffers of a thread rendering with the adaptive sampler, kept between
+    // rows and frames so that their memory is reused.
+    struct adaptive_buffers {
+        // Surface points (in world coordinates) evaluated for the row of
+        // initial cells being rendered, their positions on the image, and
+        // their indices by their position on the lattice.
+        std::vector<surface::point> points;
+        std::vector<vec<2>> image_points;
+        lattice_map indices;
+
+        // Cells of the current and the next level of subdivision, and the
+        // splits of the current one.
+        std::vector<adaptive_cell> cells;
+        std::vector<adaptive_cell> next_cells;
+        std::vector<adaptive_split> splits;
+        std::vector<uint32_t> grid;
+
+        // Parameters of the points evaluated in a batch, and the points.
+        std::vector<vec<2>> uv;
+        surface::point_array batch;
+    };
+
+    struct scratch_buffers {
+        // Used when patches are culled (see `render_culled_rows`).
+        culling_buffers culling;
+
+        // Used by the adaptive sampler (see `render_adaptive_rows`).
+        adaptive_buffers adaptive;
+    };
+
+    // Sizes of the cell's projection on the image along the `u` and `v`
+    // directions: the longer of the two projected sides going in that
+    // direction, measured along the image axis where it spans more pixels.
+    std::array<real, 2> footprint(const adaptive_cell& cell, std::span<const vec<2>> image_points) const {
+        auto extent = [&](size_t a, size_t b) {
+            vec<2> side = image_points[cell.corners[a]] - image_points[cell.corners[b]];
+            return std::max(std::abs(side[0]), std::abs(side[1]));
+        };
+        return {
+            std::max(extent(0, 1), extent(2, 3)),
+            std::max(extent(0, 2), extent(1, 3))
+        };
+    }
+
+    // Returns the index of the surface point at lattice position (u, v) in
+    // `buffers.points`. Points that weren't evaluated yet get the next free
+    // indices, and their parameters are added to `buffers.uv` to be
+    // evaluated by `sample_adaptive`.
+    static uint32_t adaptive_point(adaptive_buffers& buffers, uint32_t u, uint32_t v) {
+        auto next = static_cast<uint32_t>(buffers.points.size() + buffers.uv.size());
+        uint32_t index = buffers.indices.insert(u, v, next);
+        if (index == next) {
+            buffers.uv.push_back({
+                static_cast<real>(u) / static_cast<real>(adaptive_lattice),
+                static_cast<real>(v) / static_cast<real>(adaptive_lattice)
+            });
+        }
+        return index;
+    }
+
+    // Evaluates the surface at the parameters in `buffers.uv`, moved away from
+    // the poles, and adds the points (in world coordinates) with their
+    // positions on the image to `buffers.points`. Returns their number.
+    size_t sample_adaptive(const surface& frame_surface, adaptive_buffers& buffers) const {
+        for (auto& parameters : buffers.uv) {
+            parameters[1] = std::clamp(parameters[1], real(pole_offset), real(1 - pole_offset));
+        }
+        frame_surface.sample_batch(buffers.uv, buffers.batch);
+
+        for (size_t i = 0; i < buffers.uv.size(); ++i) {
+            surface::point p = buffers.batch[i];
+            buffers.points.push_back(p);
+            buffers.image_points.push_back(from_homogeneus(_camera_matrix * from_homogeneus(p.position)));
+        }
+
+        size_t count = buffers.uv.size();
+        buffers.uv.clear();
+        return count;
+    }
+
+    // Renders samples of rows [begin, end) of the initial adaptive cells to
+    // the `frame` buffer, using the thread's `buffers`.
+    //
+    // A cell whose projection is at most `1 / quality` pixels large along both
+    // directions is drawn as the sample at its top-left corner (each cell has
+    // a different one). Other cells are halved along the directions in which
+    // they are too large. Cells are processed one level of subdivision at a
+    // time, so that the surface points needed by a level can be sampled in a
+    // single batch.
+    //
+    // Points are identified by their position on the lattice of all possible
+    // corners (see `adaptive_lattice`), so a point shared by neighbouring
+    // cells, or by cells of different levels, is evaluated only once. Rows
+    // of initial cells are subdivided one at a time, which keeps the points
+    // in the cache (only points on the edge between two rows are evaluated
+    // twice).
+    template <bool Stats, typename Framebuffer>
+    void render_adaptive_rows(
+        const surface& frame_surface,
+        size_t begin,
+        size_t end,
+        Framebuffer& frame,
+        adaptive_buffers& buffers,
+        render_stats& stats
+    ) const {
+        const real target = real(1) / static_cast<real>(_settings.quality);
+        const uint32_t n = adaptive_grid;
+        const uint32_t initial_shift = adaptive_max_depth;
+
+        size_t samples = 0;
+        size_t evaluations = 0;
+
+        for (auto y = static_cast<uint32_t>(begin); y < end; ++y) {
+            buffers.points.clear();
+            buffers.image_points.clear();
+            buffers.indices.clear();
+            buffers.cells.clear();
+
+            // Corners of the initial cells.
+            for (uint32_t x = 0; x < n; ++x) {
+                uint32_t u = x << initial_shift;
+                uint32_t v = y << initial_shift;
+                uint32_t step = 1 << initial_shift;
+                buffers.cells.push_back({u, v, initial_shift, initial_shift, {
+                    adaptive_point(buffers, u, v),
+                    adaptive_point(buffers, u + step, v),
+                    adaptive_point(buffers, u, v + step),
+                    adaptive_point(buffers, u + step, v + step)
+                }});
+            }
+
+            for (size_t level = 0; !buffers.cells.empty(); ++level) {
+                {
+                    stage_timer<Stats> timer(stats.evaluation);
+                    evaluations += sample_adaptive(frame_surface, buffers);
+                }
+
+                stage_timer<Stats> timer(stats.projection);
+                buffers.splits.clear();
+                buffers.grid.clear();
+                for (size_t i = 0; i < buffers.cells.size(); ++i) {
+                    const auto& cell = buffers.cells[i];
+                    auto [along_u, along_v] = footprint(cell, buffers.image_points);
+                    uint32_t columns = along_u > target ? 3 : 2;
+                    uint32_t rows = along_v > target ? 3 : 2;
+                    if (level == adaptive_max_depth || (columns == 2 && rows == 2)) {
+                        render_single_sample<Stats>(buffers.points[cell.corners[0]], frame, stats);
+                        ++samples;
+                        continue;
+                    }
+
+                    // Points of the split, row by row. The corners are known, the
+                    // others are looked up and evaluated (with the next level) if
+                    // they are new.
+                    buffers.splits.push_back({i, columns, rows, buffers.grid.size()});
+                    uint32_t u_step = (1 << cell.u_shift) / (columns - 1);
+                    uint32_t v_step = (1 << cell.v_shift) / (rows - 1);
+                    for (uint32_t row = 0; row < rows; ++row) {
+                        for (uint32_t column = 0; column < columns; ++column) {
+                            bool corner = (column == 0 || column + 1 == columns) && (row == 0 || row + 1 == rows);
+                            buffers.grid.push_back(corner
+                                ? cell.corners[(row == 0 ? 0 : 2) + (column == 0 ? 0 : 1)]
+                                : adaptive_point(buffers, cell.u + column * u_step, cell.v + row * v_step));
+                        }
+                    }
+                }
+
+                buffers.next_cells.clear();
+                for (const auto& split : buffers.splits) {
+                    const auto& cell = buffers.cells[split.cell];
+                    uint32_t columns = split.columns;
+                    uint32_t u_shift = cell.u_shift - (columns == 3 ? 1 : 0);
+                    uint32_t v_shift = cell.v_shift - (split.rows == 3 ? 1 : 0);
+                    const uint32_t* grid = buffers.grid.data() + split.first_point;
+                    for (uint32_t row = 0; row + 1 < split.rows; ++row) {
+                        for (uint32_t column = 0; column + 1 < columns; ++column) {
+                            size_t i = row * columns + column;
+                            buffers.next_cells.push_back({
+                                cell.u + (column << u_shift), cell.v + (row << v_shift), u_shift, v_shift,
+                                {grid[i], grid[i + 1], grid[i + columns], grid[i + columns + 1]}
+                            });
+                        }
+                    }
+                }
+                std::swap(buffers.cells, buffers.next_cells);
+            }
+        }
+
+        _adaptive_samples += samples;
+        _adaptive_evaluations += evaluations;
+    }
+
+    // A mesh vertex projected onto the image plane.
+    struct raster_vertex {
+        // Position on the image in pixels.
+        real x;
+        real y;
+
+        // Reciprocal of the vertex depth and the normal divided by the depth.
+        // Unlike depth and normal themselves, these change linearly across a
+        // projected triangle, so they can be interpolated without distortion
+        // (see https://en.wikipedia.org/wiki/Texture_mapping#Perspective_correctness).
+        real inv_z;
+        vec<4> normal;
+    };
+
+    // Projects a point of the surface (in world coordinates) onto the image
+    // plane.
+    raster_vertex project(const surface::point& p) const {
+        auto position = from_homogeneus(p.position);
+        vec<2> image_pos = from_homogeneus(_camera_matrix * position);
+        real inv_z = 1 / position[2];
+        return {image_pos[0], image_pos[1], inv_z, p.normal * inv_z};
+    }
+
+    // Projects row `y` of the mesh vertices into `vertices`.
+    template <bool Stats>
+    void project_row(
+        const surface& frame_surface,
+        size_t y,
+        surface::point_array& points,
+        std::vector<raster_vertex>& vertices,
+        render_stats& stats
+    ) const {
+        size_t columns = grid_columns();
+        vertices.resize(columns);
+        {
+            stage_timer<Stats> timer(y < _sample_cache.rows() ? stats.projection : stats.evaluation);
+            sample_row(frame_surface, y, points);
+        }
+
+        stage_timer<Stats> timer(stats.projection);
+        for (size_t x = 0; x < columns; ++x) {
+            vertices[x] = project(points[x]);
+        }
+    }
+
+    // Renders rows [begin, end) of the mesh cells to the `frame` buffer. Cell
+    // row `y` lies between rows `y` and `y + 1` of the vertex grid, and each
+    // cell is split into two triangles.
+    template <bool Stats, typename Framebuffer>
+    void rasterize_rows(
+        const surface& frame_surface,
+        size_t begin,
+        size_t end,
+        Framebuffer& frame,
+        render_stats& stats
+    ) const {
+        size_t columns = grid_columns();
+
+        surface::point_array points;
+        std::vector<raster_vertex> top, bottom;
+
+        project_row<Stats>(frame_surface, begin, points, top, stats);
+        for (size_t y = begin; y < end; ++y) {
+            project_row<Stats>(frame_surface, y + 1, points, bottom, stats);
+
+            stage_timer<Stats> timer(stats.projection);
+            for (size_t x = 0; x < columns; ++x) {
+                size_t next = (x + 1) % columns;
+                rasterize_triangle<Stats>(top[x], top[next], bottom[x], frame, stats);
+                rasterize_triangle<Stats>(top[next], bottom[next], bottom[x], frame, stats);
+            }
+            std::swap(top, bottom);
+        }
+    }
+
+    // Edge function of the edge going from `a` to `b`, evaluated at (x, y).
+    // Its sign tells on which side of the edge the point lies, and its value is
+    // twice the area of the triangle (a, b, (x, y)).
+    //
+    // Triangles sharing an edge traverse it in opposite directions. The
+    // function is always computed from the same endpoint, so that both
+    // triangles get exactly opposite values and no pixel on the edge is missed
+    // due to rounding.
+    static real edge(const raster_vertex& a, const raster_vertex& b, real x, real y) {
+        if (std::tie(a.y, a.x) > std::tie(b.y, b.x)) {
+            return -edge(b, a, x, y);
+        }
+        return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+    }
+
+    // Fills pixels whose centers lie inside of the projected triangle (a, b, c).
+    //
+    // Pixels on the edges are drawn by all triangles sharing the edge, which
+    // makes the mesh watertight. Depth and normal of every pixel are
+    // interpolated from the vertices, and the pixel is shaded the same way as
+    // a point sample.
+    template <bool Stats, typename Framebuffer>
+    void rasterize_triangle(
+        raster_vertex a,
+        raster_vertex b,
+        raster_vertex c,
+        Framebuffer& frame,
+        render_stats& stats
+    ) const {
+        // Make the vertex order consistent, so that points inside of the
+        // triangle have non-negative edge functions.
+        real area = edge(a, b, c.x, c.y);
+        if (area == 0) {
+            return;
+        }
+        if (area < 0) {
+            std::swap(b, c);
+            area = -area;
+        }
+
+        // Bounding box of the triangle, clipped to the image. Pixel (x, y)
+        // covers [x, x + 1) x [y, y + 1) and is sampled at its center.
+        auto lowest = [](real p, real q, real r) { return std::floor(std::min({p, q, r})); };
+        auto highest = [](real p, real q, real r) { return std::ceil(std::max({p, q, r})); };
+        long min_x = std::max(0L, static_cast<long>(lowest(a.x, b.x, c.x)));
+        long min_y = std::max(0L, static_cast<long>(lowest(a.y, b.y, c.y)));
+        long max_x = std::min((long) frame.width() - 1, static_cast<long>(highest(a.x, b.x, c.x)));
+        long max_y = std::min((long) frame.height() - 1, static_cast<long>(highest(a.y, b.y, c.y)));
+
+        for (long y = min_y; y <= max_y; ++y) {
+            for (long x = min_x; x <= max_x; ++x) {
+                real center_x = static_cast<real>(x) + real(0.5);
+                real center_y = static_cast<real>(y) + real(0.5);
+
+                // Barycentric coordinates of the pixel center (scaled by the
+                // triangle area).
+                real wa = edge(b, c, center_x, center_y);
+                real wb = edge(c, a, center_x, center_y);
+                real wc = edge(a, b, center_x, center_y);
+                if (wa < 0 || wb < 0 || wc < 0) {
+                    continue;
+                }
+
+                real inv_z = (wa * a.inv_z + wb * b.inv_z + wc * c.inv_z) / area;
+                real z = 1 / inv_z;
+                if constexpr (Stats) {
+                    ++stats.samples;
+                }
+                if (frame.occluded(x, y, z)) {
+                    if constexpr (Stats) {
+                        ++stats.rejected;
+                    }
+                    continue;
+                }
+
+                vec<4> normal = (wa * a.normal + wb * b.normal + wc * c.normal) / area;
+                store(frame, x, y, z, normalize(normal * z));
+            }
+        }
+    }
+
+    // Buffers of a single frame rendered by the frame-parallel pipeline.
+    template <typename Framebuffer>
+    struct frame_buffers {
+        frame_buffers(const render_settings& settings, bool tiled)
+        : frame(settings.width, settings.height),
+          writer(settings.format),
+          scratch(1) {
+            if (tiled) {
+                bins.emplace_back(settings.width, settings.height, settings.tile_size);
+            }
+        }
+
+        Framebuffer frame;
+        frame_writer writer;
+
+        // Bins used when the frame is rendered in tiles.
+        std::vector<tile_bins> bins;
+
+        // Other buffers of the thread rendering the frame.
+        std::vector<scratch_buffers> scratch;
+
+        // Encoded frame, ready to be written out. Points either to `writer`'s
+        // buffer or to `cached`.
+        std::span<const unsigned char> encoded;
+        frame_cache::frame cached;
+    };
+
+    // Renders the animation using `frame_threads` threads, each of them
+    // rendering (and encoding) whole frames, and writes the frames to the output
+    // in order.
+    //
+    // Frame buffers are recycled: at most `frames_in_flight` of them are ever
+    // allocated. A worker first waits for a free buffer and only then claims
+    // the next frame to render. Because of that, buffers are handed out in
+    // frame order and the oldest frame that wasn't written yet always has a
+    // buffer, so the pipeline can't deadlock waiting for memory.
+    template <bool Stats, typename Framebuffer>
+    void render_frames_in_parallel() {
+        size_t in_flight = _settings.frames_in_flight;
+        if (in_flight == 0) {
+            in_flight = 2 * _settings.frame_threads;
+        }
+
+        std::mutex mutex;
+        std::condition_variable buffer_released;
+        std::condition_variable frame_finished;
+
+        std::vector<std::unique_ptr<frame_buffers<Framebuffer>>> free_buffers;
+        size_t allocated_buffers = 0;
+        std::map<size_t, std::unique_ptr<frame_buffers<Framebuffer>>> finished_frames;
+        size_t next_frame = first_frame();
+        bool stopping = false;
+
+        auto work = [&] {
+            while (true) {
+                std::unique_ptr<frame_buffers<Framebuffer>> buffers;
+                size_t frame;
+                {
+                    std::unique_lock lock(mutex);
+                    buffer_released.wait(lock, [&] {
+                        return stopping
+                            || next_frame == end_frame()
+                            || !free_buffers.empty()
+                            || allocated_buffers < in_flight;
+                    });
+                    if (stopping || next_frame == end_frame()) {
+                        return;
+                    }
+
+                    if (!free_buffers.empty()) {
+                        buffers = std::move(free_buffers.back());
+                        free_buffers.pop_back();
+                    } else {
+                        ++allocated_buffers;
+                    }
+                    frame = next_frame++;
+                }
+
+                if (!buffers) {
+                    buffers = std::make_unique<frame_buffers<Framebuffer>>(_settings, tiled());
+                }
+
+                auto key = frame_key(frame);
+                buffers->cached = _frame_cache.find(key);
+                if (buffers->cached) {
+                    buffers->encoded = *buffers->cached;
+                    std::lock_guard lock(mutex);
+                    finished_frames.emplace(frame, std::move(buffers));
+                    frame_finished.notify_one();
+                    continue;
+                }
+
+                render_stats stats;
+                {
+                    stage_timer<Stats> timer(stats.total);
+                    buffers->frame.clear();
+                    if (tiled()) {
+                        auto run = [](size_t count, const auto& task) {
+                            for (size_t i = 0; i < count; ++i) {
+                                task(i);
+                            }
+                        };
+                        render_tiled<Stats>(surface_at(frame_time(frame)), buffers->frame, buffers->bins, buffers->scratch, run);
+                    } else {
+                        render_rows<Stats>(
+                            surface_at(frame_time(frame)),
+                            0,
+                            work_rows(),
+                            buffers->frame,
+                            buffers->scratch[0],
+                            stats
+                        );
+                    }
+                    if (_settings.shading == shading_mode::deferred) {
+                        stage_timer<Stats> timer(stats.shading);
+                        shade_rows(0, _settings.height, buffers->frame);
+                    }
+
+                    stage_timer<Stats> encoding(stats.encoding);
+                    buffers->encoded = buffers->writer.encode(buffers->frame);
+                }
+                if constexpr (Stats) {
+                    count_pixels(buffers->frame, stats);
+                }
+                add_stats<Stats>(stats);
+                if (caches_frame(frame)) {
+                    _frame_cache.insert(key, buffers->encoded);
+                }
+
+                std::lock_guard lock(mutex);
+                finished_frames.emplace(frame, std::move(buffers));
+                frame_finished.notify_one();
+            }
+        };
+
+        std::vector<std::jthread> workers;
+        for (size_t i = 0; i < _settings.frame_threads; ++i) {
+            workers.emplace_back(work);
+        }
+
+        // Stops the workers if writing fails, so that they can be joined.
+        auto stop = [&] {
+            std::lock_guard lock(mutex);
+            stopping = true;
+            buffer_released.notify_all();
+        };
+
+        try {
+            // Reorder stage: write out the frames in order as they come.
+            for (size_t frame = first_frame(); frame < end_frame(); ++frame) {
+                std::unique_ptr<frame_buffers<Framebuffer>> buffers;
+                {
+                    std::unique_lock lock(mutex);
+                    frame_finished.wait(lock, [&] { return finished_frames.contains(frame); });
+                    buffers = std::move(finished_frames.extract(frame).mapped());
+                }
+
+                _output.write(buffers->encoded);
+
+                std::lock_guard lock(mutex);
+                free_buffers.push_back(std::move(buffers));
+                buffer_released.notify_one();
+            }
+        } catch (...) {
+            stop();
+            throw;
+        }
+    }
+
+    // Merges frames rendered by additional threads into the first one.
+    //
+    // When rendering with a single thread, the final color of a pixel is the
+    // color of the last sample that has the smallest depth (a sample replaces
+    // the previous one unless it is further away). Thread buffers hold the
+    // results for consecutive ranges of samples, so merging them in order with
+    // the same rule (later buffer wins unless it is further away) gives exactly
+    // the same result.
+    template <typename Framebuffer>
+    void merge_thread_buffers(std::vector<Framebuffer>& buffers) {
+        if (buffers.size() == 1) {
+            return;
+        }
+
+        // Merge is split by image rows, so that all threads can take part.
+        size_t height = buffers[0].height();
+        size_t width = buffers[0].width();
+        size_t threads = _pool.size();
+        _pool.run(threads, [&](size_t thread) {
+            size_t begin = width * (height * thread / threads);
+            size_t end = width * (height * (thread + 1) / threads);
+            for (size_t i = 1; i < buffers.size(); ++i) {
+                buffers[0].merge(buffers[i], begin, end);
+            }
+        });
+    }
+
+    // Renders a sampled 3D point to the `frame` buffer (or adds it to the
+    // bins of a `binning_target`).
+    //
+    // Note that we are rendering each `uv` sample as a single pixel. `uv`
+    // samples do not correspond to pixels on the image. By rendering a
+    // sufficiently large number of samples, we can hope to get a good coverage
+    // of the image. This isn't ideal, but it is simple and works well enough
+    // for this example.
+    //
+    // `p` is a point on the surface (in world coordinates) obtained by feeding
+    // the surface parameter equation with sampled parameters `uv`.
+    template <bool Stats, typename Framebuffer>
+    void render_single_sample(
+        const surface::point& p,
+        Framebuffer& frame,
+        render_stats& stats
+    ) const {
+        if constexpr (Stats) {
+            ++stats.samples;
+        }
+
+        // Project the point to the image plane.
+        vec<2> image_pos = from_homogeneus(_camera_matrix * from_homogeneus(p.position));
+
+        long x = static_cast<long>(image_pos[0]);
+        long y = static_cast<long>(image_pos[1]);
+        auto z = from_homogeneus(p.position)[2];
+
+        // Clip the point if it is outside of the image plane.
+        if (x < 0 || x >= (long) frame.width() || y < 0 || y >= (long) frame.height()) {
+            if constexpr (Stats) {
+                ++stats.clipped;
+            }
+            return;
+        }
+
+        // Discard the point unless it is closer than the previously rendered
+        // point at the same position.
+        if (frame.occluded(x, y, z)) {
+            if constexpr (Stats) {
+                ++stats.rejected;
+            }
+            return;
+        }
+
+        // Binned points are tested against the others binned with them once
+        // their tile is drawn.
+        if constexpr (is_binning_target<Framebuffer>) {
+            frame.bins.add(x, y, z, p.normal);
+        } else {
+            store(frame, x, y, z, p.normal);
+        }
+    }
+
+    // Stores a visible point with the given depth and `normal` at (x, y) of
+    // the `frame`: its color, or the normal itself if shading is deferred.
+    template <typename Framebuffer>
+    void store(Framebuffer& frame, size_t x, size_t y, real z, const vec<4>& normal) const {
+        if (_settings.shading == shading_mode::deferred) {
+            frame.store_normal(x, y, z, {normal[0], normal[1], normal[2]});
+        } else {
+            frame.store_color(x, y, z, shade(normal));
+        }
+    }
+
+    // Replaces the normals stored in rows [begin, end) of `frame` with
+    // colors. Pixels that no point was rendered to are left black.
+    template <typename Framebuffer>
+    void shade_rows(size_t begin, size_t end, Framebuffer& frame) const {
+        for (size_t y = begin; y < end; ++y) {
+            for (size_t x = 0; x < frame.width(); ++x) {
+                if (!frame.covered(x, y)) {
+                    continue;
+                }
+                vec<3> normal = frame.normal(x, y);
+                frame.set_color(x, y, shade({normal[0], normal[1], normal[2], 0}));
+            }
+        }
+    }
+
+    // Computes the color of a surface point with the given `normal` (in world
+    // coordinates).
+    vec<3> shade(const vec<4>& normal) const {
+        // Use Phong lighting model to compute the color of the point.
+        // Phong model is a simple model that approximates the way light
+        // interacts with a surface. It is composed of three components:
+        // ambient, diffuse, and specular.
+        //
+        // See https://en.wikipedia.org/wiki/Phong_reflection_model for details.
+
+        // Ambient component is a constant color that is added to the surface
+        // color. It represents the light that is reflected from other surfaces
+        // in the scene.
+        const real ambient_strength = real(0.1);
+        vec<3> ambient = ambient_strength * _ambient_color;
+
+        // Diffuse component is computed using the Lambert's cosine law. It
+        // represents the light that is reflected from the surface in all
+        // directions equally.
+        real diff = std::max(dot(normal, _light_direction), real(0));
+        vec<3> diffuse = diff * _light_color;
+        
+        // Specular component is computed using the Phong's reflection model.
+        // It represents the light that is reflected from the surface in a
+        // mirror-like fashion.
+        const real specular_strength = real(0.9);
+        vec<4> view_dir = {0, 0, 1, 0};
+        auto reflected = reflect(_light_direction * -1.0, normal);
+        auto spec = static_cast<real>(std::pow(std::max(dot(view_dir, reflected), real(0)), 64));
+        vec<3> specular = specular_strength * spec * _light_color;
+
+        // Combine all components to get the final color of the point.
+        return (ambient + diffuse + specular) * _surface_color;
+    }
+
+    // Slightly red ambient light.
+    const vec<3> _ambient_color = {real(0.1), 0, 0};
+
+    // White-ish light coming from the top-left.
+    const vec<3> _light_color = {1, real(0.9), real(0.8)};
+    const vec<4> _light_direction = normalize(vec<4>{-0.5, -0.5, 1.0, 0});
+
+    surface _surface;
+    const vec<3> _surface_color = {real(0.9), real(0.3), real(0.5)};
+    const vec<3> _surface_position = {0, 0, 4};
+
+    mat<3, 3> _camera_matrix;
+
+    render_settings _settings;
+
+    // Where `render` writes the frames.
+    output_stream _output;
+
+    // Writers encoding frames in turn (see `send_frame`), and the thread
+    // writing them out.
+    std::array<frame_writer, 2> _writers;
+    size_t _next_writer = 0;
+    frame_output _frame_output;
+
+    thread_pool _pool;
+
+    // Framebuffers of the threads rendering a frame (see `thread_buffers`).
+    // Only the ones of the layout chosen in the settings are allocated.
+    std::vector<split_framebuffer> _split_buffers;
+    std::vector<packed_framebuffer> _packed_buffers;
+
+    // Bins of the threads rendering a frame in tiles (see `render_tiled`).
+    std::vector<tile_bins> _tile_bins;
+
+    // Bounds of the patches of the sample grid, row by row, used when
+    // patches are culled (see `render_culled_rows`).
+    std::vector<patch_bounds> _patches;
+
+    // Buffers of the threads rendering a frame (see `scratch_buffers`).
+    std::vector<scratch_buffers> _scratch_buffers;
+
+    // Indices of the samples drawn to the pixels of a frame rendered in
+    // passes (see `render_progressive_frame`).
+    std::vector<size_t> _progressive_indices;
+
+    // Columns of the sample grid (see `surface::grid_columns`). Every row of
+    // the grid is sampled with them.
+    surface::grid_columns _grid_columns;
+
+    sample_cache _sample_cache;
+    frame_cache _frame_cache;
+
+    // Number of samples drawn and surface points evaluated by the adaptive
+    // sampler, summed over all frames.
+    mutable std::atomic<size_t> _adaptive_samples = 0;
+    mutable std::atomic<size_t> _adaptive_evaluations = 0;
+
+    std::mutex _stats_mutex;
+    render_stats _stats;
+};
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <csignal>
+#include <cstddef>
+#include <filesystem>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "renderer.hh"
+
+// Parses a single line of JSON holding a flat object, such as
+// `{"id": 1, "width": 640, "mode": "raster"}`. Values can be strings,
+// non-negative integers and booleans, which is all that render jobs need.
+// Throws `std::invalid_argument` if the line is not such an object.
+//
+// Values are returned as they were written (strings with their quotes, so that
+// they can be echoed back without escaping them again).
+inline std::map<std::string, std::string> parse_json_object(std::string_view line) {
+    size_t position = 0;
+    auto fail = [&](const std::string& message) -> void {
+        throw std::invalid_argument(message + " at offset " + std::to_string(position));
+    };
+    auto skip_spaces = [&] {
+        while (position < line.size() && std::isspace(static_cast<unsigned char>(line[position]))) {
+            ++position;
+        }
+    };
+    auto expect = [&](char c) {
+        skip_spaces();
+        if (position == line.size() || line[position] != c) {
+            fail(std::string("expected '") + c + "'");
+        }
+        ++position;
+    };
+    auto parse_string = [&] {
+        expect('"');
+        size_t begin = position - 1;
+        while (position < line.size() && line[position] != '"') {
+            if (line[position] == '\\') {
+                ++position;
+            }
+            ++position;
+        }
+        if (position >= line.size()) {
+            fail("unterminated string");
+        }
+        ++position;
+        return std::string(line.substr(begin, position - begin));
+    };
+    auto parse_value = [&] {
+        skip_spaces();
+        if (position < line.size() && line[position] == '"') {
+            return parse_string();
+        }
+        size_t begin = position;
+        while (position < line.size() && std::isalnum(static_cast<unsigned char>(line[position]))) {
+            ++position;
+        }
+        std::string value(line.substr(begin, position - begin));
+        bool number = !value.empty() && std::all_of(value.begin(), value.end(), [](char c) {
+            return std::isdigit(static_cast<unsigned char>(c));
+        });
+        if (!number && value != "true" && value != "false") {
+            fail("expected a string, a non-negative integer or a boolean");
+        }
+        return value;
+    };
+
+    std::map<std::string, std::string> object;
+    expect('{');
+    skip_spaces();
+    if (position < line.size() && line[position] == '}') {
+        ++position;
+    } else {
+        while (true) {
+            std::string key = parse_string();
+            expect(':');
+            object[key.substr(1, key.size() - 2)] = parse_value();
+            skip_spaces();
+            if (position < line.size() && line[position] == ',') {
+                ++position;
+                continue;
+            }
+            expect('}');
+            break;
+        }
+    }
+    skip_spaces();
+    if (position != line.size()) {
+        fail("unexpected characters after the object");
+    }
+    return object;
+}
+
+// A render job read by the server: settings of the animation to render, and
+// an identifier chosen by the client (a JSON value, echoed back as it is).
+struct render_job {
+    std::string id = "null";
+    render_settings settings;
+};
+
+// Reads a job from the fields of a JSON object (see `parse_json_object`).
+// Fields that are not given are taken from `defaults` (the command line
+// arguments of the server). Throws `std::invalid_argument` if the fields don't
+// describe a valid job.
+inline render_job parse_job(const std::map<std::string, std::string>& fields, const render_settings& defaults) {
+    render_job job;
+    job.settings = defaults;
+    // Jobs render whole animations, whatever their `fps` and `length`.
+    job.settings.frame_start = 0;
+    job.settings.frame_count = std::numeric_limits<size_t>::max();
+    bool chroma_444 = defaults.format == output_format::y4m_444;
+    bool y4m = defaults.format == output_format::y4m_420 || chroma_444;
+
+    for (const auto& [key, value] : fields) {
+        auto number = [&, &key = key, &value = value] {
+            if (value.empty() || !std::isdigit(static_cast<unsigned char>(value[0]))) {
+                throw std::invalid_argument(key + " must be a number");
+            }
+            return static_cast<size_t>(std::stoull(value));
+        };
+        auto choice = [&, &key = key, &value = value](std::initializer_list<const char*> names) {
+            for (size_t i = 0; i < names.size(); ++i) {
+                if (value == std::string("\"") + names.begin()[i] + "\"") {
+                    return i;
+                }
+            }
+            throw std::invalid_argument("Unknown " + key + ": " + value);
+        };
+
+        if (key == "id") {
+            job.id = value;
+        } else if (key == "width") {
+            job.settings.width = number();
+        } else if (key == "height") {
+            job.settings.height = number();
+        } else if (key == "fps") {
+            job.settings.fps = number();
+        } else if (key == "length") {
+            job.settings.length = number();
+        } else if (key == "quality") {
+            job.settings.quality = number();
+        } else if (key == "mode") {
+            job.settings.mode = static_cast<render_mode>(choice({"points", "raster", "adaptive"}));
+        } else if (key == "shading") {
+            job.settings.shading = static_cast<shading_mode>(choice({"forward", "deferred"}));
+        } else if (key == "format") {
+            size_t format = choice({"p3", "p6", "y4m"});
+            y4m = format == 2;
+            if (!y4m) {
+                job.settings.format = static_cast<output_format>(format);
+            }
+        } else if (key == "chroma") {
+            chroma_444 = choice({"420", "444"}) == 1;
+        } else if (key == "framebuffer") {
+            job.settings.framebuffer = static_cast<framebuffer_layout>(choice({"split", "packed"}));
+        } else {
+            throw std::invalid_argument("Unknown field: " + key);
+        }
+    }
+
+    if (y4m) {
+        job.settings.format = chroma_444 ? output_format::y4m_444 : output_format::y4m_420;
+    }
+    if (job.settings.width == 0 || job.settings.height == 0 || job.settings.quality == 0) {
+        throw std::invalid_argument("width, height and quality must be positive");
+    }
+    if (job.settings.fps == 0) {
+        throw std::invalid_argument("fps must be positive");
+    }
+    if (job.settings.tile_size > 0 && job.settings.mode != render_mode::raster
+        && (job.settings.width > tile_bins::max_size || job.settings.height > tile_bins::max_size)) {
+        throw std::invalid_argument("--tile-size works only with images of at most "
+            + std::to_string(tile_bins::max_size) + " x " + std::to_string(tile_bins::max_size) + " pixels");
+    }
+    if (job.settings.progressive_passes > 1 && job.settings.mode != render_mode::points) {
+        throw std::invalid_argument("--progressive works only with mode points");
+    }
+    if (job.settings.band_height > 0 && (job.settings.mode != render_mode::points || y4m)) {
+        throw std::invalid_argument("--band-height works only with mode points and PPM formats");
+    }
+    return job;
+}
+
+// Renders jobs read as lines of JSON (see `parse_job`), one after another,
+// and streams the rendered frames back.
+//
+// Every job is answered with a line of JSON: `{"id": ..., "status": "ok"}`
+// followed by the job's output as a chunked `output_stream`, or
+// `{"id": ..., "status": "error", "message": "..."}` with nothing after it.
+//
+// Starting a renderer takes a while: its buffers are allocated and the sample
+// cache is filled by evaluating the surface, which for small jobs takes longer
+// than rendering them. The server keeps the renderers of recent jobs (the
+// `max_renderers` most recently used ones) and reuses them for jobs that
+// differ only in `fps` and `length`, so that such jobs start warm, with their
+// samples and encoded frames already cached.
+class render_server {
+public:
+    render_server(const render_settings& defaults, size_t max_renderers)
+    : _defaults(defaults), _max_renderers(max_renderers) {
+        // Later jobs can take frames cached by earlier ones.
+        _defaults.reused = true;
+    }
+
+    // Serves jobs read from `input` until it is closed, writing the results to
+    // `output`.
+    void serve(int input, int output) {
+        std::string buffer;
+        char data[4096];
+        while (true) {
+            size_t end;
+            while ((end = buffer.find('\n')) == std::string::npos) {
+                ssize_t count = ::read(input, data, sizeof(data));
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count < 0) {
+                    throw std::system_error(errno, std::generic_category(), "read");
+                }
+                if (count == 0) {
+                    // The last line may be missing its newline.
+                    if (buffer.find_first_not_of(" \t\r") != std::string::npos) {
+                        run(buffer, output);
+                    }
+                    return;
+                }
+                buffer.append(data, static_cast<size_t>(count));
+            }
+
+            std::string line = buffer.substr(0, end);
+            buffer.erase(0, end + 1);
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                run(line, output);
+            }
+        }
+    }
+
+    // Serves clients connecting to a Unix socket created at `path`, one
+    // connection at a time. A client can send any number of jobs over its
+    // connection. Never returns.
+    void listen(const std::string& path) {
+        // A client that goes away would otherwise kill the server when it
+        // writes to the connection.
+        std::signal(SIGPIPE, SIG_IGN);
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw std::invalid_argument("Socket path is too long: " + path);
+        }
+        path.copy(address.sun_path, path.size());
+
+        int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server < 0) {
+            throw std::system_error(errno, std::generic_category(), "socket");
+        }
+        std::filesystem::remove(path);
+        if (::bind(server, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+            throw std::system_error(errno, std::generic_category(), "bind " + path);
+        }
+        if (::listen(server, 16) < 0) {
+            throw std::system_error(errno, std::generic_category(), "listen");
+        }
+        std::cerr << "Listening on " << path << std::endl;
+
+        while (true) {
+            int client = ::accept(server, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "accept");
+            }
+            try {
+                serve(client, client);
+            } catch (const std::system_error& error) {
+                std::cerr << "Connection closed: " << error.what() << std::endl;
+            }
+            ::close(client);
+        }
+    }
+
+private:
+    // Runs the job described by `line` and writes its result to `output`.
+    void run(const std::string& line, int output) {
+        // Replies are written as they are, only the frames are chunked.
+        auto reply = [output](const std::string& text) {
+            write_all(output, std::span(reinterpret_cast<const unsigned char*>(text.data()), text.size()));
+        };
+
+        // Ids of lines that are not JSON objects are unknown.
+        std::string id = "null";
+        renderer* r;
+        render_job job;
+        try {
+            auto fields = parse_json_object(line);
+            if (fields.contains("id")) {
+                id = fields["id"];
+            }
+            job = parse_job(fields, _defaults);
+            r = &renderer_for(job.settings);
+        } catch (const std::exception& error) {
+            reply("{\"id\": " + id + ", \"status\": \"error\", \"message\": \""
+                + escape(error.what()) + "\"}\n");
+            return;
+        }
+
+        reply("{\"id\": " + job.id + ", \"status\": \"ok\"}\n");
+        r->set_animation(job.settings.fps, job.settings.length);
+        r->render(output_stream(output, true));
+    }
+
+    // Returns a renderer set up for `settings`, reusing the one of an earlier
+    // job if there is one.
+    renderer& renderer_for(const render_settings& settings) {
+        std::string key = renderer_key(settings);
+        for (auto it = _renderers.begin(); it != _renderers.end(); ++it) {
+            if (it->first == key) {
+                // Keep the renderers ordered from the most recently used.
+                _renderers.splice(_renderers.begin(), _renderers, it);
+                return *_renderers.front().second;
+            }
+        }
+
+        // Free the memory of the evicted renderer before allocating a new one.
+        if (_renderers.size() == _max_renderers) {
+            _renderers.pop_back();
+        }
+        _renderers.emplace_front(key, std::make_unique<renderer>(settings));
+        return *_renderers.front().second;
+    }
+
+    // Describes the settings a renderer is set up with (all of them but the
+    // ones `renderer::set_animation` changes).
+    static std::string renderer_key(const render_settings& settings) {
+        return std::to_string(settings.width) + "x" + std::to_string(settings.height)
+            + " quality=" + std::to_string(settings.quality)
+            + " mode=" + std::to_string(static_cast<int>(settings.mode))
+            + " shading=" + std::to_string(static_cast<int>(settings.shading))
+            + " format=" + std::to_string(static_cast<int>(settings.format))
+            + " framebuffer=" + std::to_string(static_cast<int>(settings.framebuffer));
+    }
+
+    // Escapes `text` so that it can be put in a JSON string.
+    static std::string escape(std::string_view text) {
+        std::string result;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+            }
+            result += std::isprint(static_cast<unsigned char>(c)) ? c : ' ';
+        }
+        return result;
+    }
+
+    render_settings _defaults;
+    size_t _max_renderers;
+
+    // Renderers of recent jobs with their keys (see `renderer_key`), from the
+    // most recently used one.
+    std::list<std::pair<std::string, std::unique_ptr<renderer>>> _renderers;
+};
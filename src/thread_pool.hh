@@ -0,0 +1,118 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed-size pool of worker threads.
+//
+// The pool is used to split a batch of independent tasks (numbered from 0 to
+// `count - 1`) across all workers. Threads are created once and reused for
+// every batch, so that starting a batch costs only a couple of wake-ups instead
+// of creating and joining threads every frame.
+//
+// The calling thread participates in running the batch too, so a pool created
+// with `threads == 1` does not spawn any additional threads.
+class thread_pool {
+public:
+    explicit thread_pool(size_t threads) {
+        for (size_t i = 1; i < threads; ++i) {
+            _workers.emplace_back([this] { work(); });
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool() {
+        {
+            std::lock_guard lock(_mutex);
+            _stopping = true;
+        }
+        _wake_workers.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    // Number of threads running the tasks (including the calling thread).
+    size_t size() const {
+        return _workers.size() + 1;
+    }
+
+    // Runs `task(i)` for every `i` in [0, count) and waits until all of them
+    // are finished. Tasks are picked up by whichever thread is free first, so
+    // they must not depend on each other.
+    void run(size_t count, const std::function<void(size_t)>& task) {
+        {
+            std::lock_guard lock(_mutex);
+            _task = &task;
+            _next = 0;
+            _count = count;
+            _unfinished = count;
+            ++_batch;
+        }
+        _wake_workers.notify_all();
+
+        run_tasks();
+
+        std::unique_lock lock(_mutex);
+        _batch_done.wait(lock, [this] { return _unfinished == 0; });
+        _task = nullptr;
+    }
+
+private:
+    void work() {
+        size_t seen_batch = 0;
+        while (true) {
+            {
+                std::unique_lock lock(_mutex);
+                _wake_workers.wait(lock, [&] { return _stopping || _batch != seen_batch; });
+                if (_stopping) {
+                    return;
+                }
+                seen_batch = _batch;
+            }
+            run_tasks();
+        }
+    }
+
+    // Runs tasks of the current batch until there are none left to pick up.
+    void run_tasks() {
+        while (true) {
+            const std::function<void(size_t)>* task;
+            size_t index;
+            {
+                std::lock_guard lock(_mutex);
+                if (_task == nullptr || _next == _count) {
+                    return;
+                }
+                task = _task;
+                index = _next++;
+            }
+
+            (*task)(index);
+
+            std::lock_guard lock(_mutex);
+            if (--_unfinished == 0) {
+                _batch_done.notify_all();
+            }
+        }
+    }
+
+    std::vector<std::thread> _workers;
+
+    std::mutex _mutex;
+    std::condition_variable _wake_workers;
+    std::condition_variable _batch_done;
+
+    const std::function<void(size_t)>* _task = nullptr;
+    size_t _next = 0;
+    size_t _count = 0;
+    size_t _unfinished = 0;
+    size_t _batch = 0;
+    bool _stopping = false;
+};
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "renderer.hh"
+
+// Checks that the faster (or otherwise different) ways of rendering still
+// produce the right images.
+//
+// A reference animation is rendered with the default settings, but without
+// the optimizations that promise not to change the images (patch culling and
+// the sample cache), which makes it the most straightforward code path. It
+// can also be read from a file of golden frames saved by an earlier run,
+// possibly of another build (e.g. with `RENDERER_PRECISION` set to float).
+// Every alternative is then rendered with the same size and frames, starting
+// from the default settings, and compared with the reference: the peak signal-to-noise ratio
+// (https://en.wikipedia.org/wiki/Peak_signal-to-noise_ratio) and the largest
+// difference of a color channel have to be within the tolerances given in
+// `validation_cases`. Each alternative's speedup over the reference is
+// reported next to its error, so that the price of every mode is known.
+
+// Parameters of a validation run.
+struct validation_settings {
+    size_t width = 256;
+    size_t height = 256;
+    size_t fps = 4;
+    size_t length = 2;
+
+    // Number of times every animation is rendered. The fastest run is
+    // reported.
+    size_t repetitions = 3;
+
+    // Only cases whose name contains this string are run.
+    std::string filter;
+
+    // File the reference frames are read from, if not empty, and file they
+    // are saved to, if not empty.
+    std::string reference;
+    std::string save_reference;
+};
+
+// An alternative way of rendering the reference animation, and how much its
+// images may differ from the reference.
+struct validation_case {
+    std::string name;
+
+    // Changes the reference settings to the alternative ones.
+    std::function<void(render_settings&)> configure;
+
+    // Smallest allowed PSNR in dB (infinity if the images have to be the
+    // same), and largest allowed difference of a color channel.
+    double min_psnr;
+    int max_error;
+};
+
+// Turns off the optimizations of `settings` that promise the same images, which
+// gives the settings of the reference.
+static void unoptimize(render_settings& settings) {
+    settings.culling = false;
+    settings.sample_cache_budget = 0;
+}
+
+// Cases the validation runs, each changing the default settings. Tolerances
+// are set for the default size (256 x 256) and frames, with some margin over
+// what the renderer achieves. Errors of the approximations depend on the
+// size, so other sizes may need other tolerances.
+static std::vector<validation_case> validation_cases() {
+    const double exact = std::numeric_limits<double>::infinity();
+    return {
+        // The reference settings, rendered by this build. The same as the
+        // reference unless it was read from a file, in which case they check
+        // the build (e.g. its precision) against the golden frames.
+        {"reference", [](render_settings& s) { unoptimize(s); }, 80, 8},
+
+        // Modes that have to give exactly the same images, starting with the
+        // optimizations the reference leaves out.
+        {"defaults", [](render_settings&) {}, exact, 0},
+        {"sample_cache=0", [](render_settings& s) { s.sample_cache_budget = 0; }, exact, 0},
+        {"threads=2", [](render_settings& s) { s.threads = 2; }, exact, 0},
+        {"frame_threads=2", [](render_settings& s) { s.frame_threads = 2; }, exact, 0},
+        {"shading=forward", [](render_settings& s) { s.shading = shading_mode::forward; }, exact, 0},
+        {"tile_size=32", [](render_settings& s) { s.tile_size = 32; }, exact, 0},
+        {"progressive=3", [](render_settings& s) { s.progressive_passes = 3; }, exact, 0},
+        {"culling=off", [](render_settings& s) { s.culling = false; }, exact, 0},
+        {"band_height=37", [](render_settings& s) { s.band_height = 37; }, exact, 0},
+
+        // Packed framebuffers quantize colors and normals.
+        {"framebuffer=packed", [](render_settings& s) { s.framebuffer = framebuffer_layout::packed; }, 70, 1},
+        {"framebuffer=packed shading=forward", [](render_settings& s) {
+            s.framebuffer = framebuffer_layout::packed;
+            s.shading = shading_mode::forward;
+        }, 70, 1},
+
+        // Approximations, which differ the most along the silhouette (so any
+        // single channel may be completely off).
+        {"mode=adaptive", [](render_settings& s) { s.mode = render_mode::adaptive; }, 45, 255},
+        {"mode=raster", [](render_settings& s) { s.mode = render_mode::raster; }, 32, 255},
+        {"quality=2", [](render_settings& s) { s.quality = 2; }, 34, 255},
+        {"quality=1", [](render_settings& s) { s.quality = 1; }, 20, 255},
+    };
+}
+
+// A rendered animation: encoded P6 frames, one after another.
+struct animation {
+    std::vector<unsigned char> data;
+
+    // Seconds the fastest rendering took.
+    double seconds = 0;
+};
+
+// Renders the animation described by `settings` (`repetitions` times) and
+// returns it, keeping only the last image written for every frame (progressive
+// rendering writes previews before it).
+static animation render_animation(render_settings settings, size_t repetitions) {
+    settings.format = output_format::p6;
+    settings.frame_cache_budget = 0;
+    settings.frame_cache_directory.clear();
+
+    animation result;
+    result.seconds = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < repetitions; ++i) {
+        FILE* file = std::tmpfile();
+        if (file == nullptr) {
+            throw std::system_error(errno, std::generic_category(), "tmpfile");
+        }
+
+        renderer r(settings);
+        auto start = std::chrono::steady_clock::now();
+        r.render(output_stream(fileno(file)));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        result.seconds = std::min(result.seconds, elapsed.count());
+
+        std::rewind(file);
+        std::vector<unsigned char> data;
+        unsigned char buffer[1 << 16];
+        for (size_t count; (count = std::fread(buffer, 1, sizeof(buffer), file)) > 0;) {
+            data.insert(data.end(), buffer, buffer + count);
+        }
+        std::fclose(file);
+        result.data = std::move(data);
+    }
+
+    size_t passes = settings.progressive_passes;
+    if (passes > 1) {
+        size_t frame_size = result.data.size() / (settings.fps * settings.length * passes);
+        std::vector<unsigned char> finals;
+        for (size_t begin = (passes - 1) * frame_size; begin < result.data.size(); begin += passes * frame_size) {
+            finals.insert(finals.end(), result.data.begin() + begin, result.data.begin() + begin + frame_size);
+        }
+        result.data = std::move(finals);
+    }
+    return result;
+}
+
+// Differences between two animations.
+struct comparison {
+    double psnr;
+    int max_error;
+};
+
+static comparison compare(const animation& reference, const animation& other) {
+    if (reference.data.size() != other.data.size()) {
+        throw std::runtime_error("Animations have different sizes");
+    }
+
+    // Headers are compared too, they are the same in both.
+    double squares = 0;
+    int max_error = 0;
+    for (size_t i = 0; i < reference.data.size(); ++i) {
+        int error = std::abs(static_cast<int>(reference.data[i]) - static_cast<int>(other.data[i]));
+        squares += static_cast<double>(error * error);
+        max_error = std::max(max_error, error);
+    }
+
+    double mse = squares / static_cast<double>(reference.data.size());
+    double psnr = mse == 0 ? std::numeric_limits<double>::infinity() : 10 * std::log10(255 * 255 / mse);
+    return {psnr, max_error};
+}
+
+int main(int argc, char** argv) {
+    validation_settings settings;
+
+    const char* usage = " [--help] [--width <width>] [--height <height>] [--fps <fps>] [--length <length>] [--repetitions <runs>] [--filter <name>] [--reference <file>] [--save-reference <file>]";
+    const char* help_message = "Render the animation in every mode of the renderer and compare the images\n"
+                               "with the reference ones (rendered with the default settings, without\n"
+                               "patch culling and the sample cache). Prints the error and the speedup of\n"
+                               "every mode, and fails if an error is larger than its tolerance.\n"
+                               "\n"
+                               "Arguments:\n"
+                               "  --width <width>      Width of the images in pixels. Default: 256.\n"
+                               "  --height <height>    Height of the images in pixels. Default: 256.\n"
+                               "                       Tolerances are set for the default size, other\n"
+                               "                       sizes may fail with approximate modes.\n"
+                               "  --fps <fps>          Number of frames per second. Default: 4.\n"
+                               "  --length <length>    Length of the animation in seconds. Default: 2.\n"
+                               "  --repetitions <runs> Number of times every animation is rendered, the\n"
+                               "                       fastest one is timed. Default: 3.\n"
+                               "  --filter <name>      Run only cases whose name contains the given string.\n"
+                               "  --reference <file>   Read the reference frames from a file instead of\n"
+                               "                       rendering them (e.g. to check a float build against\n"
+                               "                       frames of a double one).\n"
+                               "  --save-reference <file>\n"
+                               "                       Save the reference frames to a file.\n";
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--help") {
+            std::cout << argv[0] << usage << std::endl;
+            std::cout << help_message << std::endl;
+            return 0;
+        } else if (std::string(argv[i]) == "--width") {
+            settings.width = std::stoi(argv[++i]);
+        } else if (std::string(argv[i]) == "--height") {
+            settings.height = std::stoi(argv[++i]);
+        } else if (std::string(argv[i]) == "--fps") {
+            settings.fps = std::stoi(argv[++i]);
+        } else if (std::string(argv[i]) == "--length") {
+            settings.length = std::stoi(argv[++i]);
+        } else if (std::string(argv[i]) == "--repetitions") {
+            settings.repetitions = std::stoi(argv[++i]);
+            if (settings.repetitions == 0) {
+                std::cerr << "Number of repetitions must be positive" << std::endl;
+                return 1;
+            }
+        } else if (std::string(argv[i]) == "--filter") {
+            settings.filter = argv[++i];
+        } else if (std::string(argv[i]) == "--reference") {
+            settings.reference = argv[++i];
+        } else if (std::string(argv[i]) == "--save-reference") {
+            settings.save_reference = argv[++i];
+        } else {
+            std::cerr << "Unknown argument: " << argv[i] << std::endl;
+            std::cerr << "Usage " << argv[0] << usage << std::endl;
+            return 1;
+        }
+    }
+
+    render_settings defaults;
+    defaults.width = settings.width;
+    defaults.height = settings.height;
+    defaults.fps = settings.fps;
+    defaults.length = settings.length;
+
+    // The reference is timed even if it is read from a file, so that the
+    // speedups are measured in this build.
+    render_settings reference_settings = defaults;
+    unoptimize(reference_settings);
+    animation rendered = render_animation(reference_settings, settings.repetitions);
+    animation reference = rendered;
+    if (!settings.reference.empty()) {
+        std::ifstream file(settings.reference, std::ios::binary);
+        if (!file) {
+            std::cerr << "Can't read the reference frames from " << settings.reference << std::endl;
+            return 1;
+        }
+        reference.data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (reference.data.size() != rendered.data.size()) {
+            std::cerr << "Reference frames in " << settings.reference
+                      << " have a different size or number of frames" << std::endl;
+            return 1;
+        }
+    }
+    if (!settings.save_reference.empty()) {
+        std::ofstream file(settings.save_reference, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(reference.data.data()), static_cast<std::streamsize>(reference.data.size()));
+        if (!file) {
+            std::cerr << "Can't save the reference frames to " << settings.save_reference << std::endl;
+            return 1;
+        }
+    }
+
+    size_t frames = settings.fps * settings.length;
+    std::cout << "Reference: " << settings.width << "x" << settings.height << ", " << frames << " frames, "
+              << std::fixed << std::setprecision(2) << rendered.seconds * 1000 / static_cast<double>(frames)
+              << " ms per frame" << (settings.reference.empty() ? "" : " (frames read from " + settings.reference + ")")
+              << "\n";
+    if (settings.width != 256 || settings.height != 256) {
+        std::cout << "Tolerances are set for 256x256 images, approximate modes may fail at this size\n";
+    }
+    std::cout << "\n";
+    std::cout << std::left << std::setw(36) << "case" << std::right
+              << std::setw(10) << "PSNR (dB)" << std::setw(11) << "max error"
+              << std::setw(14) << "ms per frame" << std::setw(9) << "speedup" << "  result\n";
+
+    bool passed = true;
+    for (const auto& test : validation_cases()) {
+        if (test.name.find(settings.filter) == std::string::npos) {
+            continue;
+        }
+
+        render_settings alternative = defaults;
+        test.configure(alternative);
+        // Modes are compared with the reference rendered by this build, so
+        // that differences of precision are checked only once.
+        bool golden = test.name == "reference";
+        animation result = golden ? rendered : render_animation(alternative, settings.repetitions);
+        comparison difference = compare(golden ? reference : rendered, result);
+
+        bool ok = difference.psnr >= test.min_psnr && difference.max_error <= test.max_error;
+        passed = passed && ok;
+
+        std::ostringstream psnr;
+        psnr << std::fixed << std::setprecision(2) << difference.psnr;
+        std::cout << std::left << std::setw(36) << test.name << std::right
+                  << std::setw(10) << (std::isinf(difference.psnr) ? "exact" : psnr.str())
+                  << std::setw(11) << difference.max_error
+                  << std::setw(14) << result.seconds * 1000 / static_cast<double>(frames)
+                  << std::setw(8) << rendered.seconds / result.seconds << "x"
+                  << "  " << (ok ? "ok" : "FAILED") << "\n";
+        if (!ok) {
+            std::cout << "    tolerance: PSNR >= " << test.min_psnr << " dB, max error <= " << test.max_error << "\n";
+        }
+    }
+
+    if (!passed) {
+        std::cout << "\nSome images differ from the reference more than allowed" << std::endl;
+        return 1;
+    }
+    return 0;
+}